@@ -74,7 +74,7 @@ typedef COUNTER_ARRAY< UINT64, COUNTER_NUM > COUNTER_HIT_MISS;
 
 // holds the counters with misses and hits
 // conceptually this is an array indexed by instruction address
-COMPRESSOR_COUNTER< ADDRINT, UINT32, COUNTER_HIT_MISS > profile;
+HASH_COMPRESSOR_COUNTER< ADDRINT, UINT32, COUNTER_HIT_MISS > profile;
 
 /* ===================================================================== */
 
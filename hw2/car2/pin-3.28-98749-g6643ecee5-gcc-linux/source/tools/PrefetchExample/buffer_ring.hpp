@@ -0,0 +1,57 @@
+#ifndef BUFFER_RING_H
+#define BUFFER_RING_H
+
+#include <atomic>
+#include <vector>
+
+using namespace std;
+
+/* ===================================================================== */
+
+// A bounded lock-free queue with exactly one thread calling push() and one calling pop().
+// One slot is kept empty to tell a full ring from an empty one.
+template <class T>
+class SPSCRing {
+public:
+  SPSCRing(const UINT32 capacity): _slots(capacity + 1), _head(0), _tail(0) {}
+  const bool push(const T &item);
+  const bool pop(T &item);
+  const bool empty() const {return _head.load(memory_order_acquire) == _tail.load(memory_order_acquire);}
+private:
+  const UINT32 next(const UINT32 slot) const {return slot + 1 == _slots.size() ? 0 : slot + 1;}
+  vector<T> _slots;
+  atomic<UINT32> _head; // next slot to pop, only written by the consumer
+  atomic<UINT32> _tail; // next slot to push, only written by the producer
+};
+
+/* ===================================================================== */
+
+// Producer side; false if the ring is full
+template <class T>
+const bool SPSCRing<T>::push(const T &item)
+{
+  UINT32 tail = _tail.load(memory_order_relaxed);
+  if (next(tail) == _head.load(memory_order_acquire)) return false;
+  _slots[tail] = item;
+  _tail.store(next(tail), memory_order_release); // publishes the item
+  return true;
+}
+
+/* ===================================================================== */
+
+// Consumer side; false if the ring is empty
+template <class T>
+const bool SPSCRing<T>::pop(T &item)
+{
+  UINT32 head = _head.load(memory_order_relaxed);
+  if (head == _tail.load(memory_order_acquire)) return false;
+  item = _slots[head];
+  _head.store(next(head), memory_order_release); // hands the slot back to the producer
+  return true;
+}
+
+#endif
+
+/* ===================================================================== */
+/* eof */
+/* ===================================================================== */
@@ -0,0 +1,59 @@
+
+/*
+ * Native replay of a memory trace recorded by the Pin tool with -record, through the same cache
+ * and prefetcher model and with the same switches, e.g.
+ *   pin -t obj-intel64/prefetcher_example.so -record bm1.trace -record_only -- ./microBench1.exe
+ *   obj-intel64/cache_replay.exe -trace bm1.trace -pref_type stride -aggr 4 -o stats_bm1_stride.out
+ */
+
+#include "pin_shim.hpp"
+#include "mem_trace.hpp"
+#include "prefetch_sim.hpp"
+
+KNOB<string> KnobTrace(KNOB_MODE_WRITEONCE, "pintool",
+  "trace", "", "memory trace recorded by prefetcher_example with -record");
+
+/* ===================================================================== */
+
+// Print a message explaining all options if invalid options are given
+INT32 Usage()
+{
+  cerr << "This tool replays a memory trace through the cache simulator." << endl;
+  cerr << KNOB_BASE::StringKnobSummary() << endl;
+  return -1;
+}
+
+/* ===================================================================== */
+/* Main                                                                  */
+/* ===================================================================== */
+
+int main(int argc, char *argv[])
+{
+    if (PIN_Init(argc, argv) || KnobTrace.Value().empty()) {
+        return Usage();
+    }
+
+    TraceReader trace(KnobTrace.Value());
+    if (!trace.good()) {
+        std::cerr << "Error: Could not read the trace " << KnobTrace.Value() << ". Simulation will be terminated." << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    setupSimulation();
+    UINT64 ea, pc;
+    UINT32 size;
+    bool isStore;
+    while (trace.next(ea, pc, size, isStore)) {
+        if (isStore) StoreMulti(ea, size, pc);
+        else LoadMulti(ea, size, pc);
+    }
+    reportSimulation();
+    cout << double(hits) / double(accesses) << endl;
+    outFile.close();
+
+    return 0;
+}
+
+/* ===================================================================== */
+/* eof */
+/* ===================================================================== */
@@ -2,11 +2,15 @@
 #define PIN_CACHE_H
 
 
+#include <cstdlib>
 #include <vector>
+#include <deque>
 #include <iostream>
 #include <sstream>
 #include <fstream>
 
+#include "tag_match.hpp"
+
 int aggression;
 
 using namespace std;
@@ -24,286 +28,728 @@ string NumberToString (T Number)
 
 /* ===================================================================== */
 
-// Implements the true LRU functionality for the d-cache and the prefetch buffer
-class LRU {
-public:
-  LRU(int n): _lru(n, 0), _ways(n) {}
-  void putWayInMRU(const int way);
-  const bool checkLRU(const int) const;
-  void swapLRUwithMRU(const int way);
-  void setLRU(const int way , const int invalids);
-  const bool checkLRU(const bool) const;
-  const int getLRU() const {return _lru.at(_ways - 1);}
-  void invalidateWay(const int);
-private:
-  vector<int> _lru;
-  int _ways;
+// The true LRU replacement policy of the d-cache and the prefetch buffers, on a stack of ways from MRU
+// (lru[0]) to LRU (lru[ways - 1]). WAYS is the associativity if it is known at compile time, 0 otherwise
+template <UINT32 WAYS>
+struct TrueLRU {
+  static const int n(const int ways) {return WAYS ? WAYS : ways;}
+  static void swapLRUwithMRU(int *lru, const int ways, const int way);
+  static void putWayInMRU(int *lru, const int ways, const int way);
+  static void setLRU(int *lru, const int ways, const int way, const int invalids);
+  static const bool checkLRU(const int *lru, const int ways, const bool allValid);
+  static const int getLRU(const int *lru, const int ways) {return lru[n(ways) - 1];}
+  static void invalidateWay(int *lru, const int ways, const int way);
 };
 
 /* ===================================================================== */
 
 // After hitting in the cache move the block to the MRU spot
-void LRU::swapLRUwithMRU(const int way)
+template <UINT32 WAYS>
+void TrueLRU<WAYS>::swapLRUwithMRU(int *lru, const int ways, const int way)
 {
-  for (int i = _ways - 1; i > 0; i--)
-    _lru.at(i) = _lru.at(i - 1);
-  _lru.at(0) = way;
+  for (int i = n(ways) - 1; i > 0; i--)
+    lru[i] = lru[i - 1];
+  lru[0] = way;
 }
 
 /* ===================================================================== */
 
 // Put a block in MRU after a demand/prefetch fill
-void LRU::putWayInMRU(const int way)
+template <UINT32 WAYS>
+void TrueLRU<WAYS>::putWayInMRU(int *lru, const int ways, const int way)
 {
   int pos = 0;
-  for (int i = 0; i < _ways; i++) {
-    if (_lru.at(i) == way ) {
+  for (int i = 0; i < n(ways); i++) {
+    if (lru[i] == way ) {
       pos =  i;
       break;
     }
   }
   for (int i = pos; i > 0; i--)
-    _lru.at(i) = _lru.at(i - 1);
-  _lru.at(0) = way;
+    lru[i] = lru[i - 1];
+  lru[0] = way;
 }
 
 /* ===================================================================== */
 
 // Put a prefetched block at the LRU position
-void LRU::setLRU(const int way, const int invalids)
+template <UINT32 WAYS>
+void TrueLRU<WAYS>::setLRU(int *lru, const int ways, const int way, const int invalids)
 {
-  if (invalids > 0) _lru.at(_ways  - invalids) = way;
-  else _lru.at(_ways  - 1) = way;
+  if (invalids > 0) lru[n(ways)  - invalids] = way;
+  else lru[n(ways)  - 1] = way;
 }
 
 /* ===================================================================== */
 
-// Check the LRU functionality for correctness issues
-const bool LRU::checkLRU(const bool allValid) const
+// Check the LRU functionality for correctness issues: every way must be on the stack once the set is full.
+// Up to 64 ways this is one pass collecting the ways in a bitmask
+template <UINT32 WAYS>
+const bool TrueLRU<WAYS>::checkLRU(const int *lru, const int ways, const bool allValid)
 {
-  if (allValid){
-    vector<bool> waysExist(_ways, false);
-    for (int i = 0; i < _ways; i++) {
-      for (int j = 0; j < _ways; j++) {
-        if ( _lru.at(j) == i) waysExist.at(i) = true;
-      }
+  if (!allValid) return true;
+  bool allExist = true;
+  if (n(ways) <= 64) {
+    UINT64 seen = 0;
+    for (int j = 0; j < n(ways); j++) {
+      if (lru[j] >= 0 && lru[j] < n(ways)) seen |= UINT64(1) << lru[j];
     }
-    for (int i = 0; i < _ways; i++) {
-      if (waysExist.at(i) == false) {
-        cout << "after" << endl;
-        for (int i = 0; i < _ways; i++) cout << "way: " << _lru.at(i) << endl;
-        return false;
+    allExist = seen == (n(ways) == 64 ? ~UINT64(0) : (UINT64(1) << n(ways)) - 1);
+  } else {
+    for (int i = 0; i < n(ways) && allExist; i++) {
+      bool wayExists = false;
+      for (int j = 0; j < n(ways); j++) {
+        if (lru[j] == i) wayExists = true;
       }
+      allExist = wayExists;
     }
   }
-  return true;
+  if (!allExist) {
+    cout << "after" << endl;
+    for (int i = 0; i < n(ways); i++) cout << "way: " << lru[i] << endl;
+  }
+  return allExist;
 }
 
 /* ===================================================================== */
 
 // Move a way to LRU after it has been invalidated
-void LRU::invalidateWay(const int way)
+template <UINT32 WAYS>
+void TrueLRU<WAYS>::invalidateWay(int *lru, const int ways, const int way)
 {
   int pos = 0;
-  for (int i = 0; i < _ways; i++) {
-    if (_lru.at(i) == way ) {
+  for (int i = 0; i < n(ways); i++) {
+    if (lru[i] == way ) {
       pos =  i;
       break;
     }
   }
-  for (int i = pos; i < _ways - 1; i++)
-    _lru.at(i) = _lru.at(i + 1);
-  _lru.at(_ways - 1) = 0;
+  for (int i = pos; i < n(ways) - 1; i++)
+    lru[i] = lru[i + 1];
+  lru[n(ways) - 1] = 0;
+}
+
+/* ===================================================================== */
+
+// A true LRU stack of its own, for the prefetch buffers
+class LRU {
+public:
+  LRU(int n): _lru(n, 0), _ways(n) {}
+  void putWayInMRU(const int way) {TrueLRU<0>::putWayInMRU(&_lru[0], _ways, way);}
+  void swapLRUwithMRU(const int way) {TrueLRU<0>::swapLRUwithMRU(&_lru[0], _ways, way);}
+  void setLRU(const int way , const int invalids) {TrueLRU<0>::setLRU(&_lru[0], _ways, way, invalids);}
+  const bool checkLRU(const bool allValid) const {return TrueLRU<0>::checkLRU(&_lru[0], _ways, allValid);}
+  const int getLRU() const {return TrueLRU<0>::getLRU(&_lru[0], _ways);}
+  void invalidateWay(const int way) {TrueLRU<0>::invalidateWay(&_lru[0], _ways, way);}
+private:
+  vector<int> _lru;
+  int _ways;
+};
+
+/* ===================================================================== */
+
+// Splits an address into its set and tag. When the block size and the number of sets are powers of
+// two this is a shift and a mask (POW2), otherwise a division and a modulo
+class SetIndexing {
+public:
+  SetIndexing(const UINT64 sets, const UINT64 blockSize);
+  const bool pow2() const {return _pow2;}
+  template <bool POW2> const UINT64 set(const UINT64 addr) const {return POW2 ? (addr >> _blockShift) & _setMask : (addr / _blockSize) % _sets;}
+  template <bool POW2> const UINT64 tag(const UINT64 addr) const {return POW2 ? addr >> _tagShift : addr / (_blockSize * _sets);}
+  template <bool POW2> const UINT64 addr(const UINT64 tag, const UINT64 set) const {return POW2 ? (tag << _tagShift) | (set << _blockShift) : (tag * _sets + set) * _blockSize;}
+private:
+  static const bool isPow2(const UINT64 n) {return n && !(n & (n - 1));}
+  static const UINT32 log2(UINT64 n) {UINT32 l = 0; while (n >>= 1) l++; return l;}
+  UINT64 _sets;
+  UINT64 _blockSize;
+  bool _pow2;
+  UINT32 _blockShift;
+  UINT32 _tagShift;
+  UINT64 _setMask;
+};
+
+/* ===================================================================== */
+
+SetIndexing::SetIndexing(const UINT64 sets, const UINT64 blockSize): _sets(sets), _blockSize(blockSize), _pow2(isPow2(sets) && isPow2(blockSize)),
+                _blockShift(log2(blockSize)), _tagShift(log2(blockSize) + log2(sets)), _setMask(sets - 1)
+{
+  if (sets == 0 || blockSize == 0) {
+    std::cerr << "Error: A cache needs at least one set and a non-zero block size. Simulation will be terminated." << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
 }
 
 /* ===================================================================== */
 
-// The class that implements the functionality of an n-way associative cache
+// Receives what happens to prefetched blocks so that it can be attributed to the prefetcher and the load that caused it
+class PrefetchEventListener {
+public:
+  virtual void prefetchUsed(const UINT64 addr) = 0;       // first demand hit on a prefetched block
+  virtual void prefetchUnused(const UINT64 addr) = 0;     // a prefetched block left without being used
+  virtual void demandBlockEvicted(const UINT64 addr) = 0; // a prefetch fill evicted a block that had been demanded
+};
+
+/* ===================================================================== */
+
+class Cache;
+
+// The operations of a Cache on the hot path, implemented by a CacheCore instance
+struct CacheOps {
+  const bool (*probeTag)(Cache &c, const UINT64 addr);
+  void (*fillLine)(Cache &c, const UINT64 addr);
+  void (*prefetchFillLine)(Cache &c, const UINT64 addr);
+  const bool (*exists)(const Cache &c, const UINT64 addr);
+  void (*invalidateAddr)(Cache &c, const UINT64 addr);
+};
+
+/* ===================================================================== */
+
+// The class that implements the functionality of an n-way associative cache.
+// The work is done by the CacheCore picked for its geometry by findCacheOps()
 class Cache {
 public:
     Cache(const int sets, const int ways, const int blockSize);
-    void fillLine(const UINT64, const UINT64 = 0);
-    void prefetchFillLine(const UINT64);
-    const bool probeTag(const UINT64 addr);
-    const bool exists(const UINT64 addr);
+    void setListener(PrefetchEventListener *listener) {_listener = listener;}
+    void fillLine(const UINT64 addr, const UINT64 = 0) {_ops->fillLine(*this, addr);}
+    void prefetchFillLine(const UINT64 addr) {_ops->prefetchFillLine(*this, addr);}
+    const bool probeTag(const UINT64 addr) {return _ops->probeTag(*this, addr);}
+    const bool exists(const UINT64 addr) const {return _ops->exists(*this, addr);}
     void store(const UINT64 addr);
     const long getPrefHits() const {return _prefHits;}
     const long getSuccessfulPrefs() const {return _successfulPrefs;}
-    void invalidateAddr(const UINT64 addr);
+    const long getUselessPrefs() const {return _uselessPrefs;}
+    const bool hitPrefetched() const {return _hitPrefetched;} // the last probeTag() was the first demand hit on a prefetched block
+    const bool specialized() const {return _specialized;} // a compile-time geometry of the registry is used
+    void invalidateAddr(const UINT64 addr) {_ops->invalidateAddr(*this, addr);}
     void print() const;
 private:
-    const int getSetInvalids(const int set) const;
-    void demandFillPrefStatsManaging(const int set, const int way);
-    const UINT64 getSet(const UINT64 addr) { return (addr / _blockSize ) % _lineNo;};
-    const UINT64 getTag(const UINT64 addr) { return addr / (_blockSize * _lineNo);};
-    void LRUcheck(const int, const bool) const;
-    vector<vector<UINT64> > _tagStore;
-    vector<vector<bool> > _validBits;
-    vector<vector<bool> > _dirtyBits;
-    vector<vector<bool> > _prefetched;
-    vector<vector<bool> > _successfulPrefetch;
-    vector<LRU*> _lru;
+    template <UINT32 SETS, UINT32 WAYS, UINT32 BLOCK_SIZE, template <UINT32> class POLICY> friend class CacheCore;
+    // state bits of a line; a line is valid if its tag is not INVALID_TAG
+    static const UINT8 PREFETCHED = 1;
+    static const UINT8 SUCCESSFUL_PREFETCH = 2; // demanded since it was prefetched
+    // the shift and mask path is picked by a branch that always goes the same way for a cache
+    const UINT64 getSet(const UINT64 addr) const { return _pow2 ? _indexing.set<true>(addr) : _indexing.set<false>(addr);};
+    const UINT64 getTag(const UINT64 addr) const { return _pow2 ? _indexing.tag<true>(addr) : _indexing.tag<false>(addr);};
+    const UINT64 getAddr(const UINT64 tag, const UINT64 set) const { return _pow2 ? _indexing.addr<true>(tag, set) : _indexing.addr<false>(tag, set);};
+    vector<UINT64> _tagStore; // sets x ways, a set at a time, compared by matchWays()
+    vector<UINT8> _state;     // sets x ways
+    vector<int> _lru;         // sets x ways, the replacement stack of each set
+    const CacheOps *_ops;
+    bool _specialized;
+    SetIndexing _indexing;
+    bool _pow2;
     UINT64 _lineNo;
-    UINT64 _blockSize;
     int _ways;
     long _prefHits;
     long _successfulPrefs;
+    long _uselessPrefs;
+    bool _hitPrefetched;
+    PrefetchEventListener *_listener;
 };
 
 /* ===================================================================== */
 
-// Default Constructor of cache
-Cache::Cache(const int sets, const int ways, const int blockSize): _tagStore(sets, vector<UINT64>(ways, 0)), _validBits(sets, vector<bool>(ways, false)), _dirtyBits(sets, vector<bool>(ways, false)),
-                _prefetched(sets, vector<bool>(ways, false)), _successfulPrefetch(sets, vector<bool>(ways, false)), _lineNo(sets), _blockSize(blockSize), _ways(ways), _prefHits(0),
-                _successfulPrefs(0)
-{
-  for (uint i = 0; i < _lineNo; i++) {
-    LRU* lru = new LRU(_ways);
-    _lru.push_back(lru);
+/* The cache operations for one geometry and replacement policy. SETS, WAYS and BLOCK_SIZE are
+    compile-time constants for the geometries of the registry, so that the way loops have a fixed
+    trip count and the set and tag are shifts and masks; all 0 for the dynamic fallback, which
+    reads the geometry from the Cache
+*/
+template <UINT32 SETS, UINT32 WAYS, UINT32 BLOCK_SIZE, template <UINT32> class POLICY>
+class CacheCore {
+public:
+  static const bool probeTag(Cache &c, const UINT64 addr);
+  static void fillLine(Cache &c, const UINT64 addr);
+  static void prefetchFillLine(Cache &c, const UINT64 addr);
+  static const bool exists(const Cache &c, const UINT64 addr);
+  static void invalidateAddr(Cache &c, const UINT64 addr);
+  static const CacheOps ops;
+private:
+  typedef POLICY<WAYS> Policy;
+  static const int ways(const Cache &c) {return WAYS ? WAYS : c._ways;}
+  static const UINT64 getSet(const Cache &c, const UINT64 addr) {return SETS ? (addr / BLOCK_SIZE) % SETS : c.getSet(addr);}
+  static const UINT64 getTag(const Cache &c, const UINT64 addr) {return SETS ? addr / (UINT64(BLOCK_SIZE) * SETS) : c.getTag(addr);}
+  static const UINT64 getAddr(const Cache &c, const UINT64 set, const int way) {
+    UINT64 tag = c._tagStore[set * ways(c) + way];
+    return SETS ? (tag * SETS + set) * BLOCK_SIZE : c.getAddr(tag, set);
   }
-}
+  static const int findWay(const Cache &c, const UINT64 set, const UINT64 tag);
+  static const int getSetInvalids(const Cache &c, const UINT64 set);
+  static void demandFillPrefStatsManaging(Cache &c, const UINT64 set, const int way);
+  static void LRUcheck(const Cache &c, const UINT64 set, const bool allValid);
+};
+
+template <UINT32 SETS, UINT32 WAYS, UINT32 BLOCK_SIZE, template <UINT32> class POLICY>
+const CacheOps CacheCore<SETS, WAYS, BLOCK_SIZE, POLICY>::ops = {probeTag, fillLine, prefetchFillLine, exists, invalidateAddr};
 
 /* ===================================================================== */
 
 // Read the Tags of a set to find a block after a demand access; triggers LRU changes
-const bool Cache::probeTag(const UINT64 addr)
+template <UINT32 SETS, UINT32 WAYS, UINT32 BLOCK_SIZE, template <UINT32> class POLICY>
+const bool CacheCore<SETS, WAYS, BLOCK_SIZE, POLICY>::probeTag(Cache &c, const UINT64 addr)
 {
-  bool hit = false;
-  int set = getSet(addr);
-  bool allValid = getSetInvalids(set) == 0;
-  for (int i = 0; i < _ways; i++) {
-    if (  _validBits.at(set).at(i) && (_tagStore.at(set).at(i) == getTag(addr))) {
-      hit = true;
-      if (_prefetched.at(set).at(i)) {
-        _prefHits++;
-        _successfulPrefetch.at(set).at(i) = true;
-      }
-      _lru.at(set)->putWayInMRU(i);
-      LRUcheck(set, allValid);
-      break;
+  c._hitPrefetched = false;
+  UINT64 set = getSet(c, addr);
+  int way = findWay(c, set, getTag(c, addr));
+  if (way < 0) return false;
+  bool allValid = getSetInvalids(c, set) == 0;
+  UINT8 &state = c._state[set * ways(c) + way];
+  if (state & Cache::PREFETCHED) {
+    c._prefHits++;
+    if (!(state & Cache::SUCCESSFUL_PREFETCH)) { // first demand hit on the prefetched block
+      c._successfulPrefs++;
+      c._hitPrefetched = true;
+      if (c._listener) c._listener->prefetchUsed(getAddr(c, set, way));
     }
+    state |= Cache::SUCCESSFUL_PREFETCH;
   }
-  return hit;
+  Policy::putWayInMRU(&c._lru[set * ways(c)], ways(c), way);
+  LRUcheck(c, set, allValid);
+  return true;
 }
 
 /* ===================================================================== */
 
 // Fill a block after a demand
-void Cache::fillLine(const UINT64 addr, const UINT64 data)
+template <UINT32 SETS, UINT32 WAYS, UINT32 BLOCK_SIZE, template <UINT32> class POLICY>
+void CacheCore<SETS, WAYS, BLOCK_SIZE, POLICY>::fillLine(Cache &c, const UINT64 addr)
 {
-  int set = getSet(addr);
-  for (int i = 0; i < _ways; i++) {
-    if (_validBits.at(set).at(i) ==  false) {
-      _validBits.at(set).at(i) =  true;
-      _tagStore.at(set).at(i) = getTag(addr);
-      demandFillPrefStatsManaging(set, i);
-      _lru.at(set)->swapLRUwithMRU(i);
-      bool allValid = getSetInvalids(set) == 0;
-      LRUcheck(set, allValid);
-      return;
-    }
-  }
+  UINT64 set = getSet(c, addr);
+  int *lru = &c._lru[set * ways(c)];
+  int way = findWay(c, set, INVALID_TAG);
   // if there is no empty way in the set find the LRU
-  int way = _lru.at(set)->getLRU();
-  _validBits.at(set).at(way) =  true;
-  _tagStore.at(set).at(way) = getTag(addr);
-  demandFillPrefStatsManaging(set, way);
-  _lru.at(set)->swapLRUwithMRU(way);
-  bool allValid = getSetInvalids(set) == 0;
-  LRUcheck(set, allValid);
+  if (way < 0) way = Policy::getLRU(lru, ways(c));
+  c._tagStore[set * ways(c) + way] = getTag(c, addr);
+  demandFillPrefStatsManaging(c, set, way);
+  Policy::swapLRUwithMRU(lru, ways(c), way);
+  bool allValid = getSetInvalids(c, set) == 0;
+  LRUcheck(c, set, allValid);
 }
 
 /* ===================================================================== */
 
 // Fill a block after a prefetch
-void Cache::prefetchFillLine(const UINT64 addr)
+template <UINT32 SETS, UINT32 WAYS, UINT32 BLOCK_SIZE, template <UINT32> class POLICY>
+void CacheCore<SETS, WAYS, BLOCK_SIZE, POLICY>::prefetchFillLine(Cache &c, const UINT64 addr)
 {
-  int set = getSet(addr);
-  int invalids = getSetInvalids(set);
+  UINT64 set = getSet(c, addr);
+  UINT8 *state = &c._state[set * ways(c)];
+  int *lru = &c._lru[set * ways(c)];
+  int invalids = getSetInvalids(c, set);
   bool allValid =  invalids == 0;
-  for (int i = 0; i < _ways; i++) {
-    if (_validBits.at(set).at(i) ==  false) {
-      _tagStore.at(set).at(i) = getTag(addr);
-      _lru.at(set)->setLRU(i, invalids);
-      _validBits.at(set).at(i) =  true;
-      _prefetched.at(set).at(i) =  true;
-      LRUcheck(set, allValid);
-      return;
-    }
+  int empty = allValid ? -1 : findWay(c, set, INVALID_TAG);
+  if (empty >= 0) {
+    c._tagStore[set * ways(c) + empty] = getTag(c, addr);
+    Policy::setLRU(lru, ways(c), empty, invalids);
+    state[empty] = Cache::PREFETCHED;
+    LRUcheck(c, set, allValid);
+    return;
   }
   // if there is no empty way in the set find the LRU
-  int way = _lru.at(set)->getLRU();
-  LRUcheck(set, allValid);
-  _validBits.at(set).at(way) =  true;
-  _tagStore.at(set).at(way) = getTag(addr);
-  _prefetched.at(set).at(way) =  true;
+  int way = Policy::getLRU(lru, ways(c));
+  LRUcheck(c, set, allValid);
+  if ((state[way] & Cache::PREFETCHED) && !(state[way] & Cache::SUCCESSFUL_PREFETCH)) {
+    c._uselessPrefs++;
+    if (c._listener) c._listener->prefetchUnused(getAddr(c, set, way));
+  } else if (c._listener) {
+    c._listener->demandBlockEvicted(getAddr(c, set, way));
+  }
+  c._tagStore[set * ways(c) + way] = getTag(c, addr);
+  state[way] = Cache::PREFETCHED;
   // leave the prefetched block at the LRU position
 }
 
 /* ===================================================================== */
 
+// Find the way of a set holding a tag, or the first invalid way for INVALID_TAG; -1 if there is none
+template <UINT32 SETS, UINT32 WAYS, UINT32 BLOCK_SIZE, template <UINT32> class POLICY>
+const int CacheCore<SETS, WAYS, BLOCK_SIZE, POLICY>::findWay(const Cache &c, const UINT64 set, const UINT64 tag)
+{
+  const UINT64 *tags = &c._tagStore[set * ways(c)];
+  if (ways(c) > 32) { // wider than a match mask
+    for (int i = 0; i < ways(c); i++) {
+      if (tags[i] == tag) return i;
+    }
+    return -1;
+  }
+  UINT32 mask = matchWays<WAYS>(tags, ways(c), tag);
+  return mask ? __builtin_ctz(mask) : -1;
+}
+
+/* ===================================================================== */
+
 // Get the number of invalid ways in a set
-const int Cache::getSetInvalids(const int set) const
+template <UINT32 SETS, UINT32 WAYS, UINT32 BLOCK_SIZE, template <UINT32> class POLICY>
+const int CacheCore<SETS, WAYS, BLOCK_SIZE, POLICY>::getSetInvalids(const Cache &c, const UINT64 set)
 {
-  int counter = 0;
-  for (int i = 0; i < _ways; i++) {
-    if (!_validBits.at(set).at(i)) counter++;
+  const UINT64 *tags = &c._tagStore[set * ways(c)];
+  if (ways(c) > 32) {
+    int counter = 0;
+    for (int i = 0; i < ways(c); i++) {
+      if (tags[i] == INVALID_TAG) counter++;
+    }
+    return counter;
   }
-  return counter;
+  return __builtin_popcount(matchWays<WAYS>(tags, ways(c), INVALID_TAG));
 }
 
 /* ===================================================================== */
 
 // Check if a tag exists in the cache without triggerring LRU changes
-const bool Cache::exists(const UINT64 addr)
+template <UINT32 SETS, UINT32 WAYS, UINT32 BLOCK_SIZE, template <UINT32> class POLICY>
+const bool CacheCore<SETS, WAYS, BLOCK_SIZE, POLICY>::exists(const Cache &c, const UINT64 addr)
 {
-  for (int i = 0; i < _ways; i++) {
-    if (_validBits.at(getSet(addr)).at(i) && (_tagStore.at(getSet(addr)).at(i) == getTag(addr)))
-      return true;
-  }
-  return false;
+  return findWay(c, getSet(c, addr), getTag(c, addr)) >= 0;
 }
 
 /* ===================================================================== */
 
 // Manage the prefetching stats when filling because of demand
-void Cache::demandFillPrefStatsManaging(const int set, const int way)
+// Successful prefetches are credited on their first hit, so only the unused ones are counted here
+template <UINT32 SETS, UINT32 WAYS, UINT32 BLOCK_SIZE, template <UINT32> class POLICY>
+void CacheCore<SETS, WAYS, BLOCK_SIZE, POLICY>::demandFillPrefStatsManaging(Cache &c, const UINT64 set, const int way)
 {
-  if (_prefetched.at(set).at(way)) {
-    if (_successfulPrefetch.at(set).at(way)) _successfulPrefs++;
+  UINT8 &state = c._state[set * ways(c) + way];
+  if ((state & Cache::PREFETCHED) && !(state & Cache::SUCCESSFUL_PREFETCH)) {
+    c._uselessPrefs++;
+    if (c._listener) c._listener->prefetchUnused(getAddr(c, set, way));
   }
-  _prefetched.at(set).at(way) = false;
-  _successfulPrefetch.at(set).at(way) = false;
+  state &= ~(Cache::PREFETCHED | Cache::SUCCESSFUL_PREFETCH);
 }
 
 /* ===================================================================== */
 
 // Invalidate a block from the cache
-void Cache::invalidateAddr(const UINT64 addr)
+template <UINT32 SETS, UINT32 WAYS, UINT32 BLOCK_SIZE, template <UINT32> class POLICY>
+void CacheCore<SETS, WAYS, BLOCK_SIZE, POLICY>::invalidateAddr(Cache &c, const UINT64 addr)
 {
-  int set = getSet(addr);
-  for (int i = 0; i < _ways; i++) {
-    if (_validBits.at(set).at(i) && (_tagStore.at(set).at(i) == getTag(addr))) {
-      _lru.at(set)->invalidateWay(i);
-      _validBits.at(set).at(i) = false;
-      bool allValid = getSetInvalids(set) == 0;
-      LRUcheck(set, allValid);
-      return;
-    }
-  }
+  UINT64 set = getSet(c, addr);
+  int way = findWay(c, set, getTag(c, addr));
+  if (way < 0) return;
+  Policy::invalidateWay(&c._lru[set * ways(c)], ways(c), way);
+  c._tagStore[set * ways(c) + way] = INVALID_TAG;
+  bool allValid = getSetInvalids(c, set) == 0;
+  LRUcheck(c, set, allValid);
 }
 
 /* ===================================================================== */
 
 // Check the LRU and exit if it is Wrong
-void Cache::LRUcheck(const int set, const bool allValid) const
+template <UINT32 SETS, UINT32 WAYS, UINT32 BLOCK_SIZE, template <UINT32> class POLICY>
+void CacheCore<SETS, WAYS, BLOCK_SIZE, POLICY>::LRUcheck(const Cache &c, const UINT64 set, const bool allValid)
 {
-  if (!_lru.at(set)->checkLRU(allValid)) {
+  if (!Policy::checkLRU(&c._lru[set * ways(c)], ways(c), allValid)) {
     cout << "lru check failled" << endl;
     exit(0);
   }
 }
 
+/* ===================================================================== */
+
+// The geometries the cache is specialized for; any other one uses the dynamic CacheCore
+struct CacheGeometry {
+  UINT32 sets;
+  UINT32 ways;
+  UINT32 blockSize;
+  const CacheOps *ops;
+};
+
+static const CacheGeometry cacheGeometries[] = {
+  {64, 2, 4, &CacheCore<64, 2, 4, TrueLRU>::ops},           // the default -sets/-a/-b: 512B
+  {64, 4, 64, &CacheCore<64, 4, 64, TrueLRU>::ops},         // 16KB
+  {64, 8, 64, &CacheCore<64, 8, 64, TrueLRU>::ops},         // 32KB L1
+  {64, 12, 64, &CacheCore<64, 12, 64, TrueLRU>::ops},       // 48KB L1
+  {512, 8, 64, &CacheCore<512, 8, 64, TrueLRU>::ops},       // 256KB L2
+  {1024, 16, 64, &CacheCore<1024, 16, 64, TrueLRU>::ops},   // 1MB L2
+  {2048, 16, 64, &CacheCore<2048, 16, 64, TrueLRU>::ops},   // 2MB LLC slice
+};
+
+// The operations for a geometry, NULL if it is not in the registry
+const CacheOps *findCacheOps(const int sets, const int ways, const int blockSize)
+{
+  for (uint i = 0; i < sizeof(cacheGeometries) / sizeof(cacheGeometries[0]); i++) {
+    const CacheGeometry &g = cacheGeometries[i];
+    if (int(g.sets) == sets && int(g.ways) == ways && int(g.blockSize) == blockSize) return g.ops;
+  }
+  return NULL;
+}
+
+/* ===================================================================== */
+
+// Default Constructor of cache
+Cache::Cache(const int sets, const int ways, const int blockSize): _tagStore(UINT64(sets) * ways, INVALID_TAG), _state(UINT64(sets) * ways, 0),
+                _lru(UINT64(sets) * ways, 0), _ops(findCacheOps(sets, ways, blockSize)), _specialized(_ops != NULL), _indexing(sets, blockSize),
+                _pow2(_indexing.pow2()), _lineNo(sets), _ways(ways), _prefHits(0), _successfulPrefs(0), _uselessPrefs(0), _hitPrefetched(false), _listener(NULL)
+{
+  if (!_ops) _ops = &CacheCore<0, 0, 0, TrueLRU>::ops;
+}
+
+/* ===================================================================== */
+
+// Common interface of the structures that hold prefetched blocks in front of the d-cache
+class PrefetchBuffer {
+public:
+  virtual const bool probeTag(const UINT64 addr) = 0;
+  virtual const bool exists(const UINT64 addr) const = 0;
+  virtual void prefetchFillLine(const UINT64 addr) = 0;
+  const long getPrefHits() const {return _prefHits;}
+  const long getFills() const {return _fills;}
+  const long getUnusedEvictions() const {return _unusedEvictions;}
+  void setListener(PrefetchEventListener *listener) {_listener = listener;}
+protected:
+  PrefetchBuffer(const int blockSize): _blockSize(blockSize), _prefHits(0), _fills(0), _unusedEvictions(0), _listener(NULL) {}
+  const UINT64 getBlock(const UINT64 addr) const { return addr / _blockSize;}
+  void hitBlock(const UINT64 block) { _prefHits++; if (_listener) _listener->prefetchUsed(block * _blockSize);}
+  void dropBlock(const UINT64 block) { _unusedEvictions++; if (_listener) _listener->prefetchUnused(block * _blockSize);}
+  UINT64 _blockSize;
+  long _prefHits;
+  long _fills;
+  long _unusedEvictions;
+  PrefetchEventListener *_listener;
+};
+
+/* ===================================================================== */
+
+// A fully associative prefetch buffer with its own true LRU
+// A demand hit removes the block from the buffer so that it can be promoted into the d-cache
+class FullyAssociativePrefetchBuffer : public PrefetchBuffer {
+public:
+  FullyAssociativePrefetchBuffer(const int entries, const int blockSize);
+  const bool probeTag(const UINT64 addr);
+  const bool exists(const UINT64 addr) const {return find(getBlock(addr)) >= 0;}
+  void prefetchFillLine(const UINT64 addr);
+private:
+  const int find(const UINT64 block) const;
+  vector<UINT64> _blocks;
+  vector<bool> _validBits;
+  LRU _lru;
+  int _entries;
+};
+
+/* ===================================================================== */
+
+FullyAssociativePrefetchBuffer::FullyAssociativePrefetchBuffer(const int entries, const int blockSize): PrefetchBuffer(blockSize),
+                _blocks(entries, 0), _validBits(entries, false), _lru(entries), _entries(entries)
+{
+}
+
+/* ===================================================================== */
+
+// Find the entry holding a block, -1 if it is not buffered
+const int FullyAssociativePrefetchBuffer::find(const UINT64 block) const
+{
+  for (int i = 0; i < _entries; i++) {
+    if (_validBits.at(i) && _blocks.at(i) == block) return i;
+  }
+  return -1;
+}
+
+/* ===================================================================== */
+
+// Look up a block after a d-cache miss; on a hit the block leaves the buffer
+const bool FullyAssociativePrefetchBuffer::probeTag(const UINT64 addr)
+{
+  int entry = find(getBlock(addr));
+  if (entry < 0) return false;
+  hitBlock(_blocks.at(entry));
+  _lru.invalidateWay(entry);
+  _validBits.at(entry) = false;
+  return true;
+}
+
+/* ===================================================================== */
+
+// Fill a prefetched block in the MRU position, evicting the LRU entry if the buffer is full
+void FullyAssociativePrefetchBuffer::prefetchFillLine(const UINT64 addr)
+{
+  _fills++;
+  for (int i = 0; i < _entries; i++) {
+    if (!_validBits.at(i)) {
+      _validBits.at(i) = true;
+      _blocks.at(i) = getBlock(addr);
+      _lru.swapLRUwithMRU(i);
+      return;
+    }
+  }
+  int entry = _lru.getLRU();
+  dropBlock(_blocks.at(entry));
+  _blocks.at(entry) = getBlock(addr);
+  _lru.putWayInMRU(entry);
+}
+
+/* ===================================================================== */
+
+// Jouppi-style multi-way stream buffers. Each stream is a FIFO of prefetched blocks;
+// the prefetches issued after a stream hit extend that stream, while the prefetches
+// issued after a miss in all streams reallocate the LRU stream.
+// Unlike the original design every entry is searched, not only the head, and the
+// entries in front of a hit are skipped.
+class StreamBuffers : public PrefetchBuffer {
+public:
+  StreamBuffers(const int streams, const int depth, const int blockSize);
+  const bool probeTag(const UINT64 addr);
+  const bool exists(const UINT64 addr) const;
+  void prefetchFillLine(const UINT64 addr);
+private:
+  void allocateStream();
+  vector<vector<UINT64> > _streams;
+  LRU _lru;
+  int _streamNo;
+  int _depth;
+  int _activeStream;
+};
+
+/* ===================================================================== */
+
+StreamBuffers::StreamBuffers(const int streams, const int depth, const int blockSize): PrefetchBuffer(blockSize), _streams(streams),
+                _lru(streams), _streamNo(streams), _depth(depth), _activeStream(-1)
+{
+}
+
+/* ===================================================================== */
+
+// Look up a block after a d-cache miss in all streams; a hit consumes the block and
+// makes the stream the target of the following prefetches
+const bool StreamBuffers::probeTag(const UINT64 addr)
+{
+  UINT64 block = getBlock(addr);
+  _activeStream = -1;
+  for (int s = 0; s < _streamNo; s++) {
+    vector<UINT64> &stream = _streams.at(s);
+    for (uint i = 0; i < stream.size(); i++) {
+      if (stream.at(i) == block) {
+        hitBlock(block);
+        for (uint j = 0; j < i; j++) dropBlock(stream.at(j));
+        stream.erase(stream.begin(), stream.begin() + i + 1);
+        if (stream.empty()) _lru.invalidateWay(s);
+        else _lru.putWayInMRU(s);
+        _activeStream = s;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+/* ===================================================================== */
+
+// Check if a block is held by any stream without changing the LRU
+const bool StreamBuffers::exists(const UINT64 addr) const
+{
+  UINT64 block = getBlock(addr);
+  for (int s = 0; s < _streamNo; s++) {
+    const vector<UINT64> &stream = _streams.at(s);
+    for (uint i = 0; i < stream.size(); i++) {
+      if (stream.at(i) == block) return true;
+    }
+  }
+  return false;
+}
+
+/* ===================================================================== */
+
+// Pick an empty stream, or flush the LRU one, for a new stream of prefetches
+void StreamBuffers::allocateStream()
+{
+  for (int s = 0; s < _streamNo; s++) {
+    if (_streams.at(s).empty()) {
+      _activeStream = s;
+      return;
+    }
+  }
+  _activeStream = _lru.getLRU();
+  for (uint i = 0; i < _streams.at(_activeStream).size(); i++) dropBlock(_streams.at(_activeStream).at(i));
+  _streams.at(_activeStream).clear();
+  _lru.invalidateWay(_activeStream);
+}
+
+/* ===================================================================== */
+
+// Append a prefetched block at the tail of the active stream, dropping its head if it is full
+void StreamBuffers::prefetchFillLine(const UINT64 addr)
+{
+  if (_activeStream < 0) allocateStream();
+  vector<UINT64> &stream = _streams.at(_activeStream);
+  _fills++;
+  if (stream.empty()) _lru.swapLRUwithMRU(_activeStream);
+  else _lru.putWayInMRU(_activeStream);
+  if ((int)stream.size() == _depth) {
+    dropBlock(stream.front());
+    stream.erase(stream.begin());
+  }
+  stream.push_back(getBlock(addr));
+}
+
+/* ===================================================================== */
+
+// The MSHRs that hold prefetches while they are in flight to memory.
+// Time is counted in accesses; all prefetches take the same latency so the queue
+// completes them in issue order.
+class InFlightQueue {
+public:
+  InFlightQueue(const int entries, const UINT64 latency, const int blockSize): _entries(entries), _latency(latency), _blockSize(blockSize) {}
+  const bool full() const {return (int)_queue.size() >= _entries;}
+  const bool exists(const UINT64 addr) const;
+  void issue(const UINT64 addr, const UINT64 now);
+  const bool remove(const UINT64 addr);
+  const bool popReady(const UINT64 now, UINT64 &addr);
+private:
+  struct Entry {
+    UINT64 block;
+    UINT64 readyTick;
+  };
+  deque<Entry> _queue;
+  int _entries;
+  UINT64 _latency;
+  UINT64 _blockSize;
+};
+
+/* ===================================================================== */
+
+// Check if the block of an address is in flight
+const bool InFlightQueue::exists(const UINT64 addr) const
+{
+  UINT64 block = addr / _blockSize;
+  for (uint i = 0; i < _queue.size(); i++) {
+    if (_queue.at(i).block == block) return true;
+  }
+  return false;
+}
+
+/* ===================================================================== */
+
+// Allocate an MSHR for a prefetch issued at tick now
+void InFlightQueue::issue(const UINT64 addr, const UINT64 now)
+{
+  Entry entry = {addr / _blockSize, now + _latency};
+  _queue.push_back(entry);
+}
+
+/* ===================================================================== */
+
+// Release the MSHR of a block that has been demanded before its prefetch completed
+const bool InFlightQueue::remove(const UINT64 addr)
+{
+  UINT64 block = addr / _blockSize;
+  for (deque<Entry>::iterator it = _queue.begin(); it != _queue.end(); ++it) {
+    if (it->block == block) {
+      _queue.erase(it);
+      return true;
+    }
+  }
+  return false;
+}
+
+/* ===================================================================== */
+
+// Pop the oldest prefetch if its data has arrived by tick now
+const bool InFlightQueue::popReady(const UINT64 now, UINT64 &addr)
+{
+  if (_queue.empty() || _queue.front().readyTick > now) return false;
+  addr = _queue.front().block * _blockSize;
+  _queue.pop_front();
+  return true;
+}
+
 #endif
 
 /* ===================================================================== */
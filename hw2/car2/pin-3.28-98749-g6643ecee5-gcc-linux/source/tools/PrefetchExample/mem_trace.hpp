@@ -0,0 +1,323 @@
+#ifndef MEM_TRACE_H
+#define MEM_TRACE_H
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+/* Memory access trace format
+    A trace starts with the 8 bytes "PFTRACE2" and is followed by chunks. A chunk header is four
+    UINT32s in host byte order: the number of accesses, the encoded size, the stored size and the
+    flags (bit 0: the payload is LZ compressed), then the stored payload. An access is encoded as a
+    varint of (pc index << 2 | new pc << 1 | is store), the pc and the access size as varints if the
+    pc is new to the chunk or accessed a different size before, and the zigzag varint delta of the
+    address from the previous address of the same pc, so a strided load takes two or three bytes.
+    Chunks are independent: the pc dictionary and the deltas start over in each of them.
+*/
+
+static const char TRACE_MAGIC[8] = {'P', 'F', 'T', 'R', 'A', 'C', 'E', '2'};
+static const UINT32 TRACE_LZ = 1;
+
+/* ===================================================================== */
+
+inline void writeVarint(vector<UINT8> &out, UINT64 value)
+{
+  while (value >= 0x80) {
+    out.push_back(UINT8(value) | 0x80);
+    value >>= 7;
+  }
+  out.push_back(UINT8(value));
+}
+
+// false if the varint runs past end
+inline const bool readVarint(const UINT8 *&pos, const UINT8 *end, UINT64 &value)
+{
+  value = 0;
+  for (int shift = 0; pos < end && shift < 64; shift += 7) {
+    UINT8 byte = *pos++;
+    value |= UINT64(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
+
+/* ===================================================================== */
+
+// LZ77 in the LZ4 block layout: a token with the literal count (high nibble) and the match length
+// minus 4 (low nibble), 255-byte length extensions for nibbles of 15, the literals and a 16-bit
+// match offset. The last sequence only has literals.
+inline void writeLZLength(vector<UINT8> &out, UINT64 length)
+{
+  for (; length >= 255; length -= 255) out.push_back(255);
+  out.push_back(UINT8(length));
+}
+
+inline void writeLZSequence(vector<UINT8> &out, const UINT8 *literals, const UINT64 literalCount, const UINT32 offset, const UINT64 matchLength)
+{
+  UINT64 extra = matchLength ? matchLength - 4 : 0;
+  out.push_back(UINT8((literalCount < 15 ? literalCount : 15) << 4 | (extra < 15 ? extra : 15)));
+  if (literalCount >= 15) writeLZLength(out, literalCount - 15);
+  out.insert(out.end(), literals, literals + literalCount);
+  if (!matchLength) return;
+  out.push_back(UINT8(offset));
+  out.push_back(UINT8(offset >> 8));
+  if (extra >= 15) writeLZLength(out, extra - 15);
+}
+
+inline void lzCompress(const vector<UINT8> &in, vector<UINT8> &out)
+{
+  const int HASH_BITS = 12;
+  vector<INT64> lastSeen(1 << HASH_BITS, -1); // last position of each hashed 4-byte sequence
+  out.clear();
+  UINT64 anchor = 0, i = 0, n = in.size();
+  while (i + 4 <= n) {
+    UINT32 sequence;
+    memcpy(&sequence, &in[i], 4);
+    UINT32 hash = (sequence * 2654435761u) >> (32 - HASH_BITS);
+    INT64 candidate = lastSeen[hash];
+    lastSeen[hash] = i;
+    if (candidate < 0 || i - candidate > 0xffff || memcmp(&in[candidate], &in[i], 4) != 0) {
+      i++;
+      continue;
+    }
+    UINT64 length = 4;
+    while (i + length < n && in[candidate + length] == in[i + length]) length++;
+    writeLZSequence(out, &in[anchor], i - anchor, i - candidate, length);
+    i += length;
+    anchor = i;
+  }
+  writeLZSequence(out, &in[0] + anchor, n - anchor, 0, 0);
+}
+
+// false if the data is corrupt or does not decode to rawSize bytes
+inline const bool lzDecompress(const UINT8 *in, const UINT64 n, vector<UINT8> &out, const UINT64 rawSize)
+{
+  out.clear();
+  out.reserve(rawSize);
+  const UINT8 *end = in + n;
+  while (in < end) {
+    UINT8 token = *in++;
+    UINT64 literals = token >> 4;
+    if (literals == 15) {
+      UINT8 byte;
+      do {
+        if (in == end) return false;
+        byte = *in++;
+        literals += byte;
+      } while (byte == 255);
+    }
+    if (UINT64(end - in) < literals) return false;
+    out.insert(out.end(), in, in + literals);
+    in += literals;
+    if (in == end) break;
+    if (end - in < 2) return false;
+    UINT64 offset = in[0] | UINT64(in[1]) << 8;
+    in += 2;
+    UINT64 length = token & 15;
+    if (length == 15) {
+      UINT8 byte;
+      do {
+        if (in == end) return false;
+        byte = *in++;
+        length += byte;
+      } while (byte == 255);
+    }
+    length += 4;
+    if (offset == 0 || offset > out.size() || out.size() + length > rawSize) return false;
+    for (UINT64 from = out.size() - offset; length > 0; length--) out.push_back(out[from++]); // may overlap itself
+  }
+  return out.size() == rawSize;
+}
+
+/* ===================================================================== */
+
+// Appends accesses to a trace file, a chunk of chunkAccesses accesses at a time
+class TraceWriter {
+public:
+  TraceWriter(const string &path, const bool compress, const UINT32 chunkAccesses = 1 << 16);
+  const bool good() const {return _out.good();}
+  void add(const UINT64 ea, const UINT64 pc, const UINT32 size, const bool isStore);
+  void close();
+  const UINT64 getAccesses() const {return _accesses;}
+  const UINT64 getBytes() const {return _bytes;}
+private:
+  void flush();
+  ofstream _out;
+  bool _compress;
+  UINT32 _chunkAccesses;
+  UINT32 _count; // accesses in the current chunk
+  vector<UINT8> _raw;
+  vector<UINT8> _packed;
+  unordered_map<UINT64, UINT64> _pcIndex;
+  vector<UINT64> _lastEA; // per pc index
+  vector<UINT32> _size;   // per pc index
+  UINT64 _accesses;
+  UINT64 _bytes;
+};
+
+/* ===================================================================== */
+
+TraceWriter::TraceWriter(const string &path, const bool compress, const UINT32 chunkAccesses): _out(path.c_str(), ios::binary),
+                _compress(compress), _chunkAccesses(chunkAccesses), _count(0), _accesses(0), _bytes(sizeof(TRACE_MAGIC))
+{
+  _out.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+}
+
+/* ===================================================================== */
+
+void TraceWriter::add(const UINT64 ea, const UINT64 pc, const UINT32 size, const bool isStore)
+{
+  unordered_map<UINT64, UINT64>::iterator it = _pcIndex.find(pc);
+  bool newPC = it == _pcIndex.end() || _size[it->second] != size;
+  UINT64 index = newPC ? _lastEA.size() : it->second;
+  writeVarint(_raw, index << 2 | UINT64(newPC) << 1 | UINT64(isStore));
+  if (newPC) {
+    writeVarint(_raw, pc);
+    writeVarint(_raw, size);
+    _pcIndex[pc] = index;
+    _lastEA.push_back(0);
+    _size.push_back(size);
+  }
+  INT64 delta = INT64(ea - _lastEA[index]);
+  writeVarint(_raw, UINT64(delta) << 1 ^ UINT64(delta >> 63));
+  _lastEA[index] = ea;
+  _accesses++;
+  if (++_count == _chunkAccesses) flush();
+}
+
+/* ===================================================================== */
+
+// Write the current chunk, compressed if that makes it smaller
+void TraceWriter::flush()
+{
+  if (_count == 0) return;
+  const vector<UINT8> *payload = &_raw;
+  UINT32 header[4] = {_count, UINT32(_raw.size()), UINT32(_raw.size()), 0};
+  if (_compress) {
+    lzCompress(_raw, _packed);
+    if (_packed.size() < _raw.size()) {
+      payload = &_packed;
+      header[2] = _packed.size();
+      header[3] = TRACE_LZ;
+    }
+  }
+  _out.write(reinterpret_cast<const char *>(header), sizeof(header));
+  _out.write(reinterpret_cast<const char *>(&payload->at(0)), payload->size());
+  _bytes += sizeof(header) + payload->size();
+  _count = 0;
+  _raw.clear();
+  _pcIndex.clear();
+  _lastEA.clear();
+  _size.clear();
+}
+
+/* ===================================================================== */
+
+void TraceWriter::close()
+{
+  flush();
+  _out.close();
+}
+
+/* ===================================================================== */
+
+// Reads the accesses of a trace file in order
+class TraceReader {
+public:
+  TraceReader(const string &path);
+  const bool good() const {return _good;}
+  const bool next(UINT64 &ea, UINT64 &pc, UINT32 &size, bool &isStore);
+private:
+  const bool readChunk();
+  void corrupt() const;
+  ifstream _in;
+  bool _good;
+  vector<UINT8> _stored;
+  vector<UINT8> _raw;
+  const UINT8 *_pos;
+  const UINT8 *_end;
+  UINT32 _left; // accesses left in the current chunk
+  vector<UINT64> _pcs;
+  vector<UINT64> _lastEA;
+  vector<UINT32> _sizes;
+};
+
+/* ===================================================================== */
+
+TraceReader::TraceReader(const string &path): _in(path.c_str(), ios::binary), _good(false), _pos(NULL), _end(NULL), _left(0)
+{
+  char magic[sizeof(TRACE_MAGIC)];
+  _in.read(magic, sizeof(magic));
+  _good = _in.good() && memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0;
+}
+
+/* ===================================================================== */
+
+void TraceReader::corrupt() const
+{
+  std::cerr << "Error: The trace is corrupt. Simulation will be terminated." << std::endl;
+  std::exit(EXIT_FAILURE);
+}
+
+/* ===================================================================== */
+
+// Load the next chunk; false at the end of the trace
+const bool TraceReader::readChunk()
+{
+  UINT32 header[4];
+  _in.read(reinterpret_cast<char *>(header), sizeof(header));
+  if (_in.gcount() == 0) return false;
+  // a chunk holds at least one access, which takes at least two bytes encoded and one stored
+  if (_in.gcount() != sizeof(header) || header[0] == 0 || header[1] == 0 || header[2] == 0) corrupt();
+  _stored.resize(header[2]);
+  _in.read(reinterpret_cast<char *>(&_stored[0]), header[2]);
+  if (UINT32(_in.gcount()) != header[2]) corrupt();
+  if (header[3] & TRACE_LZ) {
+    if (!lzDecompress(&_stored[0], _stored.size(), _raw, header[1])) corrupt();
+  } else {
+    _raw.swap(_stored);
+  }
+  _pos = &_raw[0];
+  _end = _pos + _raw.size();
+  _left = header[0];
+  _pcs.clear();
+  _lastEA.clear();
+  _sizes.clear();
+  return true;
+}
+
+/* ===================================================================== */
+
+const bool TraceReader::next(UINT64 &ea, UINT64 &pc, UINT32 &size, bool &isStore)
+{
+  if (_left == 0 && !readChunk()) return false;
+  UINT64 code = 0, delta = 0, accessSize = 0;
+  if (!readVarint(_pos, _end, code)) corrupt();
+  UINT64 index = code >> 2;
+  if (code & 2) {
+    if (index != _pcs.size() || !readVarint(_pos, _end, pc) || !readVarint(_pos, _end, accessSize)) corrupt();
+    _pcs.push_back(pc);
+    _lastEA.push_back(0);
+    _sizes.push_back(accessSize);
+  }
+  if (index >= _pcs.size() || !readVarint(_pos, _end, delta)) corrupt();
+  pc = _pcs[index];
+  size = _sizes[index];
+  ea = _lastEA[index] + UINT64(INT64(delta >> 1) ^ -INT64(delta & 1));
+  _lastEA[index] = ea;
+  isStore = code & 1;
+  _left--;
+  return true;
+}
+
+#endif
+
+/* ===================================================================== */
+/* eof */
+/* ===================================================================== */
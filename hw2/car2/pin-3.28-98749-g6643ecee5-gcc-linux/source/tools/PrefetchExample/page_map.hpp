@@ -0,0 +1,122 @@
+#ifndef PAGE_MAP_H
+#define PAGE_MAP_H
+
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "prefetch_tables.hpp"
+
+using namespace std;
+
+/* Simulated page mapping (-page_map)
+    The caches are indexed by virtual address unless a page mapping is given; then every demand
+    access is translated to a physical address before it reaches the d-cache, so the sets are
+    physically indexed. A page gets its frame on its first access, as with demand paging:
+      sequential: the frames in the order the pages are first touched
+      random:     a random free frame, like a system whose free list has long been shuffled
+      colored:    the next free frame of the same color as the virtual page (page coloring), so
+                  the set index bits above the page offset are kept
+      huge:       2MB pages, handed out in order
+    The prefetchers still train on virtual addresses. A prefetch is only issued if its page is
+    already mapped, as hardware cannot prefetch across a page boundary into a page whose
+    translation it does not know.
+*/
+class PageMapper {
+public:
+  enum Policy {SEQUENTIAL, RANDOM, COLORED, HUGE_PAGES};
+  PageMapper(const Policy policy, const UINT64 physicalBytes, const UINT32 colors);
+  const UINT64 translate(const UINT64 vaddr);                     // maps the page on its first access
+  const bool lookup(const UINT64 vaddr, UINT64 &paddr) const;     // false if the page is not mapped yet
+  const UINT64 pageSize() const {return _pageSize;}
+  void print(ostream &out) const;
+private:
+  const UINT64 allocateFrame(const UINT64 page);
+  Policy _policy;
+  UINT64 _pageSize;
+  UINT64 _frames;
+  UINT32 _colors;
+  unordered_map<UINT64, UINT64> _frameOf; // virtual page -> physical frame
+  vector<UINT32> _freeFrames;             // random: the free frames are the tail from _allocated on
+  vector<UINT64> _nextOfColor;            // colored: frames of each color handed out so far
+  UINT64 _allocated;
+};
+
+/* ===================================================================== */
+
+PageMapper::PageMapper(const Policy policy, const UINT64 physicalBytes, const UINT32 colors): _policy(policy),
+                _pageSize(policy == HUGE_PAGES ? 2 << 20 : 4 << 10), _frames(physicalBytes / _pageSize), _colors(colors), _allocated(0)
+{
+  if (_frames == 0 || (policy == COLORED && (colors == 0 || _frames % colors != 0))) {
+    std::cerr << "Error: The physical memory must hold at least one page, and a multiple of the page colors. Simulation will be terminated." << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  if (policy == RANDOM) {
+    _freeFrames.resize(_frames);
+    for (UINT64 i = 0; i < _frames; i++) _freeFrames[i] = i;
+  }
+  if (policy == COLORED) _nextOfColor.assign(colors, 0);
+}
+
+/* ===================================================================== */
+
+const UINT64 PageMapper::allocateFrame(const UINT64 page)
+{
+  if (_allocated == _frames) {
+    std::cerr << "Error: The simulated physical memory is full, use a larger -phys_mem. Simulation will be terminated." << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  if (_policy == RANDOM) {
+    // one step of a Fisher-Yates shuffle: a random free frame is swapped to the front of the free ones
+    UINT64 pick = _allocated + hashKey(_allocated + 1) % (_frames - _allocated);
+    swap(_freeFrames[_allocated], _freeFrames[pick]);
+    return _freeFrames[_allocated++];
+  }
+  if (_policy == COLORED) {
+    UINT32 color = page % _colors;
+    if (_nextOfColor[color] == _frames / _colors) {
+      std::cerr << "Error: No free page of color " << color << " is left, use a larger -phys_mem. Simulation will be terminated." << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+    _allocated++;
+    return _nextOfColor[color]++ * _colors + color;
+  }
+  return _allocated++;
+}
+
+/* ===================================================================== */
+
+const UINT64 PageMapper::translate(const UINT64 vaddr)
+{
+  UINT64 page = vaddr / _pageSize;
+  unordered_map<UINT64, UINT64>::iterator it = _frameOf.find(page);
+  UINT64 frame = it != _frameOf.end() ? it->second : (_frameOf[page] = allocateFrame(page));
+  return frame * _pageSize + vaddr % _pageSize;
+}
+
+/* ===================================================================== */
+
+const bool PageMapper::lookup(const UINT64 vaddr, UINT64 &paddr) const
+{
+  unordered_map<UINT64, UINT64>::const_iterator it = _frameOf.find(vaddr / _pageSize);
+  if (it == _frameOf.end()) return false;
+  paddr = it->second * _pageSize + vaddr % _pageSize;
+  return true;
+}
+
+/* ===================================================================== */
+
+void PageMapper::print(ostream &out) const
+{
+  static const char *names[] = {"sequential", "random", "colored", "huge"};
+  out << "Page mapping: " << names[_policy] << ", " << _frameOf.size() << " pages of " << _pageSize << "B mapped of " << _frames;
+  if (_policy == COLORED) out << ", " << _colors << " colors";
+  out << endl;
+}
+
+#endif
+
+/* ===================================================================== */
+/* eof */
+/* ===================================================================== */
@@ -0,0 +1,118 @@
+#ifndef PIN_SHIM_H
+#define PIN_SHIM_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// The Pin types and KNOB switches used by prefetch_sim.hpp, for native builds without pin.H
+// such as cache_replay.cpp
+
+typedef uint8_t UINT8;
+typedef uint16_t UINT16;
+typedef int32_t INT32;
+typedef uint32_t UINT32;
+typedef int64_t INT64;
+typedef uint64_t UINT64;
+typedef UINT64 ADDRINT;
+typedef bool BOOL;
+#define VOID void
+#define TRUE true
+#define FALSE false
+
+enum KNOB_MODE { KNOB_MODE_WRITEONCE };
+
+/* ===================================================================== */
+
+inline const bool parseKnobValue(const string &text, string &value) {value = text; return true;}
+
+inline const bool parseKnobValue(const string &text, bool &value)
+{
+  if (text == "1" || text == "true") value = true;
+  else if (text == "0" || text == "false") value = false;
+  else return false;
+  return true;
+}
+
+template <class T>
+const bool parseKnobValue(const string &text, T &value)
+{
+  istringstream in(text);
+  return (in >> value) && in.eof();
+}
+
+/* ===================================================================== */
+
+class KNOB_BASE {
+public:
+  KNOB_BASE(const string &name, const string &defaultValue, const string &purpose, const bool isBool):
+                  _name(name), _default(defaultValue), _purpose(purpose), _isBool(isBool) {knobs().push_back(this);}
+  virtual ~KNOB_BASE() {}
+
+  static string StringKnobSummary() {
+    ostringstream out;
+    for (size_t i = 0; i < knobs().size(); i++)
+      out << "-" << knobs()[i]->_name << " [default " << knobs()[i]->_default << "]\n\t" << knobs()[i]->_purpose << "\n";
+    return out.str();
+  }
+
+  // Parse "-name value" switches; a BOOL switch may come without its value. False on an invalid command line
+  static const bool parse(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+      if (argv[i][0] != '-') return false;
+      KNOB_BASE *knob = find(argv[i] + 1);
+      if (knob == NULL) return false;
+      if (knob->_isBool && (i + 1 == argc || argv[i + 1][0] == '-')) knob->set("1");
+      else if (i + 1 == argc || !knob->set(argv[++i])) return false;
+    }
+    return true;
+  }
+
+protected:
+  virtual const bool set(const string &value) = 0;
+
+private:
+  static vector<KNOB_BASE *> &knobs() {static vector<KNOB_BASE *> all; return all;}
+  static KNOB_BASE *find(const string &name) {
+    for (size_t i = 0; i < knobs().size(); i++) if (knobs()[i]->_name == name) return knobs()[i];
+    return NULL;
+  }
+  string _name;
+  string _default;
+  string _purpose;
+  bool _isBool;
+};
+
+/* ===================================================================== */
+
+template <class T>
+class KNOB : public KNOB_BASE {
+public:
+  KNOB(const KNOB_MODE mode, const string &family, const string &name, const string &defaultValue, const string &purpose):
+                  KNOB_BASE(name, defaultValue, purpose, isBool((T *)NULL)), _value() {set(defaultValue);}
+  const T &Value() const {return _value;}
+  operator T() const {return _value;}
+protected:
+  const bool set(const string &value) {return parseKnobValue(value, _value);}
+private:
+  static const bool isBool(const bool *) {return true;}
+  template <class U> static const bool isBool(const U *) {return false;}
+  T _value;
+};
+
+/* ===================================================================== */
+
+// Returns true if the command line is invalid, like PIN_Init()
+inline BOOL PIN_Init(int argc, char *argv[]) {return !KNOB_BASE::parse(argc, argv);}
+
+#endif
+
+/* ===================================================================== */
+/* eof */
+/* ===================================================================== */
@@ -0,0 +1,1398 @@
+#ifndef PREFETCH_SIM_H
+#define PREFETCH_SIM_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "dcache_for_prefetcher.hpp"
+#include "page_map.hpp"
+#include "prefetch_stats.hpp"
+#include "prefetch_tables.hpp"
+#include "set_sampling.hpp"
+#include "stack_distance.hpp"
+#include "tlb.hpp"
+
+// The cache and prefetcher model, shared by the Pin tool (prefetcher_example.cpp) and the native
+// trace replay (cache_replay.cpp). The Pin types and KNOB come from pin.H or pin_shim.hpp.
+
+class PrefetcherInterface {
+public:
+  PrefetcherInterface(): degree(aggression), distance(1) {}
+  virtual void prefetch(ADDRINT addr, ADDRINT loadPC) = 0;
+  virtual void train(ADDRINT addr, ADDRINT loadPC) = 0;
+  virtual void observe(ADDRINT addr, ADDRINT loadPC) {} // every demand access, trigger or not, if observes()
+  virtual const bool observes() const {return false;}
+  virtual UINT64 getMetadataBytes() const {return 0;} // storage the prefetcher would need in hardware
+  void setAggressiveness(int newDegree, int newDistance) {degree = newDegree; distance = newDistance;}
+  const int getDegree() const {return degree;}
+  const int getDistance() const {return distance;}
+protected:
+  int degree;   // prefetches per trigger, -aggr unless adapted at runtime
+  int distance; // how far ahead, in blocks or strides, the first prefetch is
+};
+
+PrefetcherInterface *prefetcher;
+
+// Collects the prefetches proposed by the components of a CompositePrefetcher instead of issuing them
+class PrefetchCollector {
+public:
+  virtual void propose(UINT64 addr) = 0;
+};
+
+PrefetchCollector *collector = NULL;
+
+ofstream outFile;
+Cache *cache;
+PrefetchBuffer *prefBuffer = NULL; // optional buffer holding the prefetched blocks in front of the d-cache
+InFlightQueue *mshr = NULL; // prefetches waiting for memory, only used with a non-zero memory latency
+Cache *shadowCache = NULL; // demand-only tag directory used to detect the misses caused by prefetching
+PrefetchAccounting *accounting;
+UINT64 loads;
+UINT64 stores;
+UINT64 hits;
+UINT64 accesses, prefetches;
+UINT64 droppedPrefetches, shadowMisses;
+UINT64 unmappedPrefetches; // prefetches into a page -page_map has not mapped yet
+UINT64 triggers; // accesses the prefetcher was run on
+UINT64 splitAccesses; // loads and stores that spanned more than one block, each block counts as an access
+UINT64 instructions = 0; // counted by the Pin tool with -sample_sets or -tlb, for the MPKI
+SetSampler *sampler = NULL; // only the sampled sets are simulated with -sample_sets
+vector<StackDistanceProfiler *> stackProfilers; // -stack_distance, fully associative first
+PageMapper *pageMap = NULL; // the d-cache is physically indexed with -page_map
+TLBHierarchy *tlb = NULL;          // -tlb
+TLBHierarchy *idealHugeTLB = NULL; // -tlb_ideal_huge: the same TLBs with every page 2MB
+DemandProfile *demandProfile = NULL; // demand load misses per PC for -delinquent, not kept by the shards
+string prefetcherName;
+int sets;
+int associativity;
+int blockSize;
+UINT64 checkpoint = 100000000;
+UINT64 endpoint = 2000000000;
+UINT32 shardCount = 0; // set partitions the Pin tool simulates in parallel with -shards, 0 when the cache is not sharded
+
+// Set by the Pin tool with -shards: route a prefetch to the shard owning the block, false if it would not
+// fill anything, and sum the used prefetches of the shards
+bool (*routePrefetch)(UINT64 addr) = NULL;
+long (*shardSuccessfulPrefs)() = NULL;
+
+// Set by the Pin tool: the routine a PC belongs to, for the delinquent load report
+string (*pcName)(UINT64 pc) = NULL;
+
+/* ===================================================================== */
+/* Commandline Switches */
+/* ===================================================================== */
+
+KNOB<string> KnobPrefetcherName(KNOB_MODE_WRITEONCE, "pintool",
+  "pref_type","none", "prefetcher name, or several joined by + (e.g. stride+next_n_lines)");
+KNOB<UINT32> KnobAggression(KNOB_MODE_WRITEONCE, "pintool",
+  "aggr", "2", "the aggression of the prefetcher");
+KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool",
+  "o", "data", "specify output file name");
+KNOB<UINT32> KnobCacheSets(KNOB_MODE_WRITEONCE, "pintool",
+  "sets", "64", "cache size in kilobytes");
+KNOB<UINT32> KnobLineSize(KNOB_MODE_WRITEONCE, "pintool",
+  "b", "4", "cache block size in bytes");
+KNOB<UINT32> KnobAssociativity(KNOB_MODE_WRITEONCE, "pintool",
+  "a", "2", "cache associativity (1 for direct mapped)");
+KNOB<string> KnobPrefetchBuffer(KNOB_MODE_WRITEONCE, "pintool",
+  "pref_buffer", "none", "where prefetched blocks are placed: none (in the d-cache), fa (fully associative prefetch buffer), stream (stream buffers)");
+KNOB<UINT32> KnobPrefBufferEntries(KNOB_MODE_WRITEONCE, "pintool",
+  "pb_entries", "16", "number of blocks in the fully associative prefetch buffer");
+KNOB<UINT32> KnobStreamBuffers(KNOB_MODE_WRITEONCE, "pintool",
+  "sb_count", "4", "number of stream buffers");
+KNOB<UINT32> KnobStreamBufferDepth(KNOB_MODE_WRITEONCE, "pintool",
+  "sb_depth", "4", "number of blocks in each stream buffer");
+KNOB<UINT32> KnobMemLatency(KNOB_MODE_WRITEONCE, "pintool",
+  "mem_latency", "0", "prefetch latency in accesses (0 makes prefetched blocks available immediately)");
+KNOB<UINT32> KnobMSHREntries(KNOB_MODE_WRITEONCE, "pintool",
+  "mshr_entries", "16", "maximum number of prefetches in flight");
+KNOB<UINT32> KnobRPTEntries(KNOB_MODE_WRITEONCE, "pintool",
+  "rpt_entries", "64", "number of entries in the reference prediction table of the stride prefetcher");
+KNOB<UINT32> KnobRPTWays(KNOB_MODE_WRITEONCE, "pintool",
+  "rpt_ways", "4", "associativity of the reference prediction table");
+KNOB<UINT32> KnobDistEntries(KNOB_MODE_WRITEONCE, "pintool",
+  "dist_entries", "64", "number of entries in the table of the distance prefetcher");
+KNOB<UINT32> KnobDistWays(KNOB_MODE_WRITEONCE, "pintool",
+  "dist_ways", "4", "associativity of the table of the distance prefetcher");
+KNOB<UINT32> KnobSMSRegion(KNOB_MODE_WRITEONCE, "pintool",
+  "sms_region", "2048", "region size in bytes of the spatial memory streaming prefetcher");
+KNOB<UINT32> KnobSMSAGTEntries(KNOB_MODE_WRITEONCE, "pintool",
+  "sms_agt", "64", "number of active generations tracked by the spatial memory streaming prefetcher");
+KNOB<UINT32> KnobSMSPHTEntries(KNOB_MODE_WRITEONCE, "pintool",
+  "sms_pht_entries", "1024", "number of footprints in the pattern history table of the spatial memory streaming prefetcher");
+KNOB<UINT32> KnobSMSPHTWays(KNOB_MODE_WRITEONCE, "pintool",
+  "sms_pht_ways", "4", "associativity of the pattern history table");
+KNOB<UINT32> KnobMarkovBudget(KNOB_MODE_WRITEONCE, "pintool",
+  "markov_kb", "64", "metadata budget in kilobytes of the markov prefetcher");
+KNOB<UINT32> KnobMarkovSuccessors(KNOB_MODE_WRITEONCE, "pintool",
+  "markov_succ", "4", "number of successors kept per miss block by the markov prefetcher");
+KNOB<UINT32> KnobIssueBudget(KNOB_MODE_WRITEONCE, "pintool",
+  "issue_budget", "4", "prefetches a composite prefetcher (-pref_type a+b) may issue per trigger, 0 for no limit");
+KNOB<string> KnobTrainOn(KNOB_MODE_WRITEONCE, "pintool",
+  "train_on", "miss", "accesses that run the prefetcher: miss, prefetched_hit (misses and first hits on prefetched blocks) or all");
+KNOB<BOOL> KnobTrainStores(KNOB_MODE_WRITEONCE, "pintool",
+  "train_stores", "0", "run the prefetcher on stores as well as loads");
+KNOB<BOOL> KnobAdaptive(KNOB_MODE_WRITEONCE, "pintool",
+  "adaptive", "0", "adapt the degree and distance of the prefetcher at runtime (feedback directed prefetching), needs -mem_latency");
+KNOB<UINT32> KnobFDPInterval(KNOB_MODE_WRITEONCE, "pintool",
+  "fdp_interval", "16384", "number of accesses between two feedback directed prefetching decisions");
+KNOB<BOOL> KnobPollution(KNOB_MODE_WRITEONCE, "pintool",
+  "pollution", "1", "measure cache pollution with a demand-only shadow tag directory");
+KNOB<UINT32> KnobSampleSets(KNOB_MODE_WRITEONCE, "pintool",
+  "sample_sets", "0", "only simulate this many sets of the d-cache and extrapolate the stats, 0 to simulate all of them");
+KNOB<string> KnobSampleMode(KNOB_MODE_WRITEONCE, "pintool",
+  "sample_mode", "stride", "sets simulated with -sample_sets: stride (evenly spaced) or hash");
+KNOB<BOOL> KnobStackDistance(KNOB_MODE_WRITEONCE, "pintool",
+  "stack_distance", "0", "also profile the LRU stack distances and print the miss ratio of every fully associative cache size");
+KNOB<string> KnobSDSets(KNOB_MODE_WRITEONCE, "pintool",
+  "sd_sets", "", "with -stack_distance, also print the miss ratio of every associativity for these numbers of sets, e.g. 64,1024");
+KNOB<UINT32> KnobSDMaxBlocks(KNOB_MODE_WRITEONCE, "pintool",
+  "sd_max_blocks", "1048576", "largest cache, in blocks, that -stack_distance reports");
+KNOB<UINT32> KnobPCReport(KNOB_MODE_WRITEONCE, "pintool",
+  "pc_report", "20", "number of load PCs listed in the per-PC prefetch report");
+KNOB<string> KnobPageMap(KNOB_MODE_WRITEONCE, "pintool",
+  "page_map", "none", "index the d-cache by simulated physical addresses, with frames assigned none/sequential/random/colored/huge");
+KNOB<UINT32> KnobPhysMem(KNOB_MODE_WRITEONCE, "pintool",
+  "phys_mem", "4096", "simulated physical memory in MB for -page_map");
+KNOB<UINT32> KnobPageColors(KNOB_MODE_WRITEONCE, "pintool",
+  "page_colors", "0", "page colors of -page_map colored, 0 for as many as the d-cache has sets per 4KB page");
+KNOB<BOOL> KnobTLB(KNOB_MODE_WRITEONCE, "pintool",
+  "tlb", "0", "also simulate an L1 DTLB and an L2 STLB with page walks");
+KNOB<UINT32> KnobDTLBEntries(KNOB_MODE_WRITEONCE, "pintool",
+  "dtlb_entries", "64", "entries of the L1 DTLB");
+KNOB<UINT32> KnobDTLBWays(KNOB_MODE_WRITEONCE, "pintool",
+  "dtlb_ways", "4", "associativity of the L1 DTLB");
+KNOB<UINT32> KnobSTLBEntries(KNOB_MODE_WRITEONCE, "pintool",
+  "stlb_entries", "1536", "entries of the L2 STLB");
+KNOB<UINT32> KnobSTLBWays(KNOB_MODE_WRITEONCE, "pintool",
+  "stlb_ways", "12", "associativity of the L2 STLB");
+KNOB<UINT32> KnobTLBPageSize(KNOB_MODE_WRITEONCE, "pintool",
+  "tlb_page_size", "0", "page size of -tlb, 4096, 2097152 or 1073741824; 0 for the pages of -page_map, 4KB without it");
+KNOB<UINT32> KnobPSCEntries(KNOB_MODE_WRITEONCE, "pintool",
+  "psc_entries", "32", "entries of each paging-structure cache of -tlb");
+KNOB<UINT32> KnobSTLBLatency(KNOB_MODE_WRITEONCE, "pintool",
+  "stlb_latency", "7", "cycles of an STLB lookup");
+KNOB<UINT32> KnobWalkLatency(KNOB_MODE_WRITEONCE, "pintool",
+  "walk_latency", "20", "cycles of each page table read of a page walk");
+KNOB<BOOL> KnobTLBIdealHuge(KNOB_MODE_WRITEONCE, "pintool",
+  "tlb_ideal_huge", "0", "with -tlb, also simulate the same TLBs with every page 2MB, the best case of transparent huge pages");
+KNOB<UINT32> KnobDelinquent(KNOB_MODE_WRITEONCE, "pintool",
+  "delinquent", "20", "number of load PCs with the most demand misses listed at the end, 0 for none");
+
+/* ===================================================================== */
+
+// Take checkpoints with stats in the output file
+void takeCheckPoint()
+{
+  outFile << "The checkpoint has been reached" << endl;
+  outFile << "Accesses: " << accesses << " Loads: "<< loads << " Stores: " << stores <<   endl;
+  outFile << "Hits: " << hits << endl;
+  outFile << "Hit rate: " << double(hits) / double(accesses) << endl;
+  outFile << "Prefetches: " << prefetches << endl;
+  outFile << "Successful prefetches: " << (shardSuccessfulPrefs ? shardSuccessfulPrefs() : cache->getSuccessfulPrefs()) + (prefBuffer ? prefBuffer->getPrefHits() : 0) << endl;
+  if (prefBuffer) {
+    outFile << "Prefetch buffer hits: " << prefBuffer->getPrefHits() << endl;
+    outFile << "Prefetch buffer unused evictions: " << prefBuffer->getUnusedEvictions() << endl;
+  }
+  if (mshr) outFile << "Dropped prefetches (MSHRs full): " << droppedPrefetches << endl;
+  if (pageMap) {
+    pageMap->print(outFile);
+    outFile << "Dropped prefetches (unmapped pages): " << unmappedPrefetches << endl;
+  }
+  if (tlb) tlb->print(outFile, "TLB", instructions);
+  if (idealHugeTLB) idealHugeTLB->print(outFile, "TLB with ideal huge pages", instructions);
+  outFile << "Prefetcher triggers: " << triggers << endl;
+  outFile << "Split-line accesses: " << splitAccesses << endl;
+  if (shadowCache) outFile << "Misses without prefetching (shadow tags): " << shadowMisses << endl;
+  if (sampler) sampler->print(outFile, instructions);
+  accounting->print(outFile, accesses - hits);
+  outFile << "Prefetcher metadata: " << prefetcher->getMetadataBytes() << " bytes" << endl;
+  if (accesses ==  endpoint) exit(0);
+}
+
+/* ===================================================================== */
+
+// Place a prefetched block in the prefetch buffer when there is one, otherwise in the LRU position of the d-cache
+void fillPrefetch(UINT64 addr)
+{
+  accounting->filling(addr);
+  if (prefBuffer) prefBuffer->prefetchFillLine(addr);
+  else cache->prefetchFillLine(addr); // Use the member function Cache::prefetchFillLine(UINT64) when you fill the cache in the LRU way for prefetch accesses
+}
+
+/* ===================================================================== */
+
+// Prefetch the block of addr unless it is already present or in flight, and return whether it was issued.
+// Without a memory latency the block is filled at once, otherwise it waits in an MSHR
+bool issuePrefetch(UINT64 addr)
+{
+  if (collector) { // a composite prefetcher arbitrates the candidates first
+    collector->propose(addr);
+    return false;
+  }
+  if (routePrefetch) return routePrefetch(addr); // the shard owning the block fills it
+  if (pageMap && !pageMap->lookup(addr, addr)) { // the prefetcher works on virtual addresses
+    unmappedPrefetches++;
+    return false;
+  }
+  int sample = sampler ? sampler->sampleOf(addr) : 0;
+  if (sample < 0) return false; // the set is not simulated
+  if (cache->exists(addr)) return false; // Use the member function Cache::exists(UINT64) to query whehter a block exists in the cache w/o triggering any LRU changes (not after a demand access)
+  if (prefBuffer && prefBuffer->exists(addr)) return false;
+  if (mshr) {
+    if (mshr->exists(addr)) return false;
+    if (mshr->full()) {
+      droppedPrefetches++;
+      return false;
+    }
+    mshr->issue(addr, accesses);
+    accounting->issued(addr);
+  } else {
+    accounting->issued(addr);
+    fillPrefetch(addr);
+  }
+  prefetches++;
+  if (sampler) sampler->prefetchIssued(sample);
+  return true;
+}
+
+/* ===================================================================== */
+
+// Fill the prefetches whose data has arrived by the current access
+void completePrefetches()
+{
+  UINT64 addr;
+  while (mshr->popReady(accesses, addr)) {
+    if (!cache->exists(addr) && !(prefBuffer && prefBuffer->exists(addr))) fillPrefetch(addr);
+    else accounting->prefetchUnused(addr);
+  }
+}
+
+/* ===================================================================== */
+
+// Replay a demand access on the shadow tag directory; a miss that hits there was caused by prefetching
+void shadowAccess(UINT64 addr, bool miss)
+{
+  if (shadowCache->probeTag(addr)) {
+    if (miss) accounting->pollutionMiss(addr);
+  } else {
+    shadowMisses++;
+    shadowCache->fillLine(addr);
+  }
+}
+
+/* ===================================================================== */
+
+/* None Prefetcher
+    This does not prefetch anything.
+*/
+class NonePrefetcher : public PrefetcherInterface {
+public:
+  void prefetch(ADDRINT addr, ADDRINT loadPC) {
+    return;
+  }
+
+  void train(ADDRINT addr, ADDRINT loadPC) {
+    return;
+  }
+};
+
+/* ===================================================================== */
+
+/* Next Line Prefetcher
+    This is an example implementation of the next line Prefetcher.
+    The stride prefetcher would also need the program counter of the load instruction.
+*/
+class NextNLinePrefetcher : public PrefetcherInterface {
+public:
+  void prefetch(ADDRINT addr, ADDRINT loadPC) {
+    for (int i = distance; i < distance + degree; i++) {
+      UINT64 nextAddr = addr + i * blockSize;
+      issuePrefetch(nextAddr);
+    }
+  }
+
+  void train(ADDRINT addr, ADDRINT loadPC) {
+    return;
+  }
+};
+
+// Demand accesses that run the prefetcher (-train_on)
+enum TrainTrigger { TRAIN_ON_MISS, TRAIN_ON_PREFETCHED_HIT, TRAIN_ON_ALL };
+TrainTrigger trainOn = TRAIN_ON_MISS;
+
+/* ===================================================================== */
+
+// States of a Reference Prediction Table entry
+enum StrideState { INITIAL, TRANSIENT, STEADY, NO_PREDICTION };
+
+// An entry of the Reference Prediction Table, tagged by the load PC
+struct RPTEntry {
+  RPTEntry(): prevAddr(0), stride(0), state(INITIAL) {}
+  UINT64 prevAddr; // previous address
+  INT64 stride;
+  StrideState state;
+};
+
+class StridePrefetcher : public PrefetcherInterface {
+  private:
+    SetAssocTable<RPTEntry> RPT; // Reference Prediction Table, indexed by a hash of the load PC
+    RPTEntry *entry = NULL; // RPT entry of the current PC, found by prefetch() and updated by train()
+
+  public:
+    StridePrefetcher(int entries, int ways): RPT(entries, ways) {}
+
+    UINT64 getMetadataBytes() const {return RPT.getEntries() * (3 * sizeof(UINT64) + 1);} // PC tag, previous address, stride, state
+
+    void prefetch(ADDRINT addr, ADDRINT loadPC) {
+      entry = RPT.find(loadPC);
+      if (entry == NULL) return;
+      UINT64 pred_addr = entry->prevAddr + entry->stride;
+      // begin prefetching only if the state is stable and prediction is correct
+      // NOTE check if we need state == STEADY or state != NO_PREDICTION
+      if (pred_addr == addr && entry->state == STEADY) { // correct prediction in the correct state
+        for (int i = distance; i < distance + degree; i++) {
+          UINT64 nextAddr = addr + i * entry->stride;
+          issuePrefetch(nextAddr);
+        }
+      }
+    }
+
+    void train(ADDRINT addr, ADDRINT loadPC) {
+
+      if (entry == NULL) { // add the entry in RPT as PC not in RPT, replacing the LRU entry of its set
+        entry = RPT.insert(loadPC);
+        entry->prevAddr = addr; // set the previous addr to current addr
+        return;
+      }
+      // we found the entry in the RPT - PC present can use the same entry from prefetch
+      UINT64 prev_addr = entry->prevAddr; // previous addr
+      UINT64 pred_addr = prev_addr + entry->stride; // predicted addr = previous addr + stride
+      bool correct = addr == pred_addr;
+      switch (entry->state) {
+        case INITIAL:
+          if (correct) entry->state = STEADY;
+          else {
+            entry->state = TRANSIENT;
+            entry->stride = addr - prev_addr; // update the stride
+          }
+          entry->prevAddr = addr;
+          break;
+        case TRANSIENT:
+          if (correct) entry->state = STEADY;
+          else {
+            entry->state = NO_PREDICTION;
+            entry->stride = addr - prev_addr;
+          }
+          entry->prevAddr = addr;
+          break;
+        case STEADY:
+          if (correct) {
+            // // This part for updating is sort of confusing and different mediums provide different interpretation
+            // When only misses train, the next one comes after the prefetched blocks; otherwise the prefetched hits keep following the stream
+            if (trainOn == TRAIN_ON_MISS) entry->prevAddr = addr + ((distance + degree - 1) * entry->stride); // update the previous address to address of last prefetched block
+            else entry->prevAddr = addr;
+          } else {
+            entry->state = INITIAL;
+            entry->prevAddr = addr;
+          }
+          break;
+        case NO_PREDICTION:
+          if (correct) entry->state = TRANSIENT;
+          else entry->stride = addr - prev_addr;
+          entry->prevAddr = addr;
+          break;
+      }
+    }
+};
+
+
+// An entry of the distance table, tagged by a miss distance. Its predicted distances
+// live in the slot arena of the prefetcher, a fixed number of slots per entry.
+struct DistanceEntry {
+  DistanceEntry(): nextSlot(0) {}
+  int nextSlot; // slot replaced next once all of them hold a distance
+};
+
+// NOTE: For some reason the microbenchmark2 results are fluctuating a lot, this doens't happen with other benchmarks
+// A trigger prefetches with degree of the predicted distances of its entry, skipping the first distance - 1;
+// an entry keeps as many as the most aggressive level can use, -aggr of them unless -adaptive
+class DistancePrefetcher : public PrefetcherInterface {
+  private:
+    UINT64 prev_addr = 0; // previous miss address
+    INT64 prev_dist = 0; // previous distance
+    SetAssocTable<DistanceEntry> RPT; // Reference Prediction Table, indexed by a hash of the distance
+    vector<INT64> slots; // predicted distances of every RPT entry in one contiguous arena, 0 when empty
+    bool entryFound; // for every prefetch if the entry is found in RPT
+    int predictions; // predicted distances per RPT entry
+
+    INT64 *getSlots(const DistanceEntry *entry) {return slots.data() + RPT.getIndex(entry) * predictions;}
+
+  public:
+    DistancePrefetcher(int entries, int ways, int predictionsPerEntry): RPT(entries, ways),
+                    slots(UINT64(entries) * predictionsPerEntry, 0), predictions(predictionsPerEntry) {}
+
+    UINT64 getMetadataBytes() const {return RPT.getEntries() * sizeof(INT64) + slots.size() * sizeof(INT64);} // distance tags and predicted distances
+
+    void prefetch(ADDRINT addr, ADDRINT loadPC) {
+
+      INT64 new_dist = addr - prev_addr; // get the new distance
+      DistanceEntry *entry = RPT.find(new_dist);
+      entryFound = entry != NULL; // in train no need to add the entry
+      if (!entryFound) return;
+      INT64 *predicted = getSlots(entry);
+      for (int i = distance - 1; i < distance - 1 + degree && i < predictions; i++) { // prefetch
+        if (predicted[i] != 0) { // don't need but helps
+          UINT64 nextAddr = addr + predicted[i]; // get all the predicted addresses
+          issuePrefetch(nextAddr);
+        }
+      }
+
+    }
+
+    void train(ADDRINT addr, ADDRINT loadPC) {
+      INT64 new_dist = addr - prev_addr; // get the new distance
+
+      if (entryFound==FALSE) { // add the entry in RPT corresponding to new dist as it is not present, replacing the LRU entry of its set
+        INT64 *predicted = getSlots(RPT.insert(new_dist));
+        for (int i = 0; i < predictions; i++) predicted[i] = 0; // initialize the predicted distances
+      }
+
+      // newly observed distance must be added as a predicted distance to the RPT entry that refers to the previous distance
+      DistanceEntry *entry = RPT.find(prev_dist);
+      if (entry != NULL && predictions > 0) {
+        INT64 *predicted = getSlots(entry);
+        bool pdFull = TRUE; // flag to check if any of the predicted distance is empty
+        for (int i = 0; i < predictions; i++) {
+          if (predicted[i] == 0) {
+            predicted[i] = new_dist;
+            pdFull = FALSE;
+            break;
+          }
+        }
+
+        if (pdFull == TRUE) { // if predicted distance not empty then replace them round robin
+          predicted[entry->nextSlot] = new_dist;
+          entry->nextSlot = (entry->nextSlot + 1) % predictions;
+        }
+      }
+
+      prev_addr = addr;
+      prev_dist = new_dist;
+
+    }
+};
+
+
+/* Best-Offset Prefetcher (Michaud, HPCA 2016)
+    Learns a single offset D, in blocks, and prefetches X + D for every trigger block X.
+    Each trigger block X tests one candidate offset d of the list: if X - d is in the recent
+    requests table, then a prefetch with offset d would have covered X, so d scores a point.
+    A learning phase ends after ROUND_MAX passes over the list or when an offset reaches
+    SCORE_MAX; the best offset is then used, unless its score is too low to prefetch at all.
+    The recent requests table is filled at trigger time rather than when the prefetch completes.
+    A degree above 1 issues X + D, X + 2D, ... and a distance above 1 starts further ahead.
+*/
+class BestOffsetPrefetcher : public PrefetcherInterface {
+  private:
+    static const int RR_ENTRIES = 256;
+    static const int SCORE_MAX = 31;
+    static const int ROUND_MAX = 100;
+    static const int BAD_SCORE = 1;
+    vector<int> offsets; // candidate offsets: 1..64 with no prime factor other than 2, 3 and 5
+    vector<int> scores;
+    vector<UINT64> recentRequests; // direct mapped, holds block numbers + 1 (0 is empty)
+    int testIdx = 0;
+    int round = 0;
+    int bestOffset = 1;
+    bool prefetchOn = true;
+
+    const int rrIndex(UINT64 block) const {return hashKey(block) % RR_ENTRIES;}
+
+    void endPhase(int best) {
+      bestOffset = offsets.at(best);
+      prefetchOn = scores.at(best) > BAD_SCORE;
+      for (uint i = 0; i < scores.size(); i++) scores.at(i) = 0;
+      testIdx = 0;
+      round = 0;
+    }
+
+  public:
+    BestOffsetPrefetcher(): recentRequests(RR_ENTRIES, 0) {
+      for (int d = 1; d <= 64; d++) {
+        int r = d;
+        while (r % 2 == 0) r /= 2;
+        while (r % 3 == 0) r /= 3;
+        while (r % 5 == 0) r /= 5;
+        if (r == 1) offsets.push_back(d);
+      }
+      scores.assign(offsets.size(), 0);
+    }
+
+    UINT64 getMetadataBytes() const {return RR_ENTRIES * sizeof(UINT64) + scores.size();} // recent requests and 5-bit scores
+
+    void prefetch(ADDRINT addr, ADDRINT loadPC) {
+      if (!prefetchOn) return;
+      UINT64 block = addr / blockSize;
+      for (int i = distance; i < distance + degree; i++) issuePrefetch((block + UINT64(i) * bestOffset) * blockSize);
+    }
+
+    void train(ADDRINT addr, ADDRINT loadPC) {
+      UINT64 block = addr / blockSize;
+      UINT64 base = block - offsets.at(testIdx);
+      bool covered = recentRequests.at(rrIndex(base)) == base + 1;
+      recentRequests.at(rrIndex(block)) = block + 1;
+      if (covered && ++scores.at(testIdx) >= SCORE_MAX) {
+        endPhase(testIdx);
+        return;
+      }
+      if (++testIdx == (int)offsets.size()) {
+        testIdx = 0;
+        if (++round == ROUND_MAX) endPhase(max_element(scores.begin(), scores.end()) - scores.begin());
+      }
+    }
+};
+
+/* ===================================================================== */
+
+/* Sandbox Prefetcher (Pugsley et al., HPCA 2014)
+    Evaluates candidate offsets one at a time without issuing real prefetches: during an
+    evaluation period every trigger block X adds X + d to a Bloom filter (the sandbox) and
+    checks whether X itself is already there, which means offset d would have covered it.
+    After each period the score of d is updated and the offsets whose score reaches
+    ACCURACY_CUTOFF are ranked; the best (degree) of them are used for real prefetches.
+*/
+class SandboxPrefetcher : public PrefetcherInterface {
+  private:
+    static const int PERIOD = 256;
+    static const int ACCURACY_CUTOFF = PERIOD / 4;
+    static const int FILTER_BITS = 2048;
+    static const int FILTER_HASHES = 3;
+    vector<int> offsets; // -8..-1 and 1..8 blocks
+    vector<int> scores;
+    vector<int> active; // offsets used for real prefetches, best first
+    vector<bool> sandbox;
+    int candidate = 0;
+    int periodAccesses = 0;
+    int score = 0;
+
+    const UINT64 filterIndex(UINT64 block, int k) const {return hashKey(block * FILTER_HASHES + k) % FILTER_BITS;}
+
+    const bool inSandbox(UINT64 block) const {
+      for (int k = 0; k < FILTER_HASHES; k++)
+        if (!sandbox.at(filterIndex(block, k))) return false;
+      return true;
+    }
+
+    void addToSandbox(UINT64 block) {
+      for (int k = 0; k < FILTER_HASHES; k++) sandbox.at(filterIndex(block, k)) = true;
+    }
+
+    // Close the evaluation of the current candidate and rank the offsets again
+    void endPeriod() {
+      scores.at(candidate) = score;
+      vector<pair<int, int> > ranked; // score, offset
+      for (uint i = 0; i < offsets.size(); i++)
+        if (scores.at(i) >= ACCURACY_CUTOFF) ranked.push_back(make_pair(scores.at(i), offsets.at(i)));
+      sort(ranked.rbegin(), ranked.rend());
+      active.clear();
+      for (uint i = 0; i < ranked.size(); i++) active.push_back(ranked.at(i).second);
+      candidate = (candidate + 1) % offsets.size();
+      periodAccesses = 0;
+      score = 0;
+      sandbox.assign(FILTER_BITS, false);
+    }
+
+  public:
+    SandboxPrefetcher(): sandbox(FILTER_BITS, false) {
+      for (int d = -8; d <= 8; d++)
+        if (d != 0) offsets.push_back(d);
+      scores.assign(offsets.size(), 0);
+    }
+
+    UINT64 getMetadataBytes() const {return FILTER_BITS / 8 + scores.size() * sizeof(UINT16);} // sandbox and scores
+
+    void prefetch(ADDRINT addr, ADDRINT loadPC) {
+      UINT64 block = addr / blockSize;
+      for (uint i = 0; i < active.size() && (int)i < degree; i++) issuePrefetch((block + active.at(i)) * blockSize);
+    }
+
+    void train(ADDRINT addr, ADDRINT loadPC) {
+      UINT64 block = addr / blockSize;
+      if (inSandbox(block)) score++;
+      addToSandbox(block + offsets.at(candidate));
+      if (++periodAccesses == PERIOD) endPeriod();
+    }
+};
+
+/* ===================================================================== */
+
+/* Spatial Memory Streaming Prefetcher (Somogyi et al., ISCA 2006)
+    Memory is divided into regions of -sms_region bytes. The first access to a region is the
+    trigger of a generation; the accumulation table (AGT) records the footprint of the blocks
+    touched in the region until the generation ends, and the footprint is then stored in the
+    pattern history table (PHT) under the trigger (PC, offset in region). A later trigger with
+    the same PC and offset prefetches the whole learned footprint.
+    A generation ends when its region is replaced in the AGT, which stands in for the eviction
+    of one of its blocks from the cache. The footprint is prefetched whatever the degree.
+    The AGT records every demand access to an active region through observe(), not only the
+    triggers, or the blocks SMS prefetched would hit, drop out of the next footprint and wipe
+    the learned pattern.
+*/
+struct SMSGeneration {
+  UINT64 triggerPC;
+  int triggerOffset;
+  vector<bool> footprint;
+};
+
+struct SMSPattern {
+  vector<bool> footprint;
+};
+
+class SMSPrefetcher : public PrefetcherInterface {
+  private:
+    SetAssocTable<SMSGeneration> AGT; // active generations, by region
+    SetAssocTable<SMSPattern> PHT;    // learned footprints, by trigger PC and offset
+    UINT64 regionSize;
+    int regionBlocks;
+    SMSGeneration *generation = NULL; // AGT entry of the current region, found by prefetch() and updated by train()
+
+    const UINT64 patternKey(UINT64 pc, int offset) const {return pc * regionBlocks + offset;}
+
+  public:
+    SMSPrefetcher(UINT64 region, int agtEntries, int phtEntries, int phtWays): AGT(agtEntries, agtEntries), PHT(phtEntries, phtWays),
+                  regionSize(region), regionBlocks(region / blockSize) {}
+
+    UINT64 getMetadataBytes() const { // region tag, trigger PC and offset, footprint in the AGT; PC+offset tag and footprint in the PHT
+      UINT64 footprint = (regionBlocks + 7) / 8;
+      return AGT.getEntries() * (2 * sizeof(UINT64) + sizeof(UINT16) + footprint) + PHT.getEntries() * (sizeof(UINT64) + footprint);
+    }
+
+    void prefetch(ADDRINT addr, ADDRINT loadPC) {
+      generation = AGT.find(addr / regionSize);
+      if (generation != NULL) return; // not a trigger access
+      UINT64 base = addr - addr % regionSize;
+      int offset = (addr % regionSize) / blockSize;
+      SMSPattern *pattern = PHT.find(patternKey(loadPC, offset));
+      if (pattern == NULL) return;
+      for (int i = 0; i < regionBlocks; i++)
+        if (i != offset && pattern->footprint.at(i)) issuePrefetch(base + UINT64(i) * blockSize);
+    }
+
+    const bool observes() const {return true;}
+
+    void observe(ADDRINT addr, ADDRINT loadPC) {
+      SMSGeneration *active = AGT.find(addr / regionSize);
+      if (active != NULL) active->footprint.at((addr % regionSize) / blockSize) = true;
+    }
+
+    void train(ADDRINT addr, ADDRINT loadPC) {
+      int offset = (addr % regionSize) / blockSize;
+      if (generation == NULL) { // start a new generation, ending the one it replaces
+        bool replaced;
+        UINT64 region;
+        SMSGeneration ended;
+        generation = AGT.insert(addr / regionSize, replaced, region, ended);
+        generation->triggerPC = loadPC;
+        generation->triggerOffset = offset;
+        generation->footprint.assign(regionBlocks, false);
+        if (replaced) {
+          UINT64 key = patternKey(ended.triggerPC, ended.triggerOffset);
+          SMSPattern *pattern = PHT.find(key);
+          if (pattern == NULL) pattern = PHT.insert(key);
+          pattern->footprint = ended.footprint;
+        }
+      }
+      generation->footprint.at(offset) = true;
+    }
+};
+
+/* ===================================================================== */
+
+/* Markov Prefetcher (Joseph and Grunwald, ISCA 1997)
+    A temporal correlation prefetcher for pointer chasing codes: the table maps every miss
+    block to the blocks that missed right after it, most recent first, and prefetches up to
+    degree of them. The table is sized from a metadata budget (-markov_kb), with
+    -markov_succ successors per entry, so that its coverage can be weighed against its storage.
+*/
+struct MarkovEntry {
+  MarkovEntry(): count(0) {}
+  int count; // successors held in the slot arena of the prefetcher
+};
+
+class MarkovPrefetcher : public PrefetcherInterface {
+  private:
+    static const int WAYS = 8;
+    int successors;
+    SetAssocTable<MarkovEntry> table; // indexed by a hash of the miss block
+    vector<UINT64> slots; // successor blocks of every entry, most recent first
+    UINT64 prevBlock = 0;
+    bool havePrev = false;
+
+    static int entriesFor(UINT64 budget, int successors) {
+      int entries = budget / ((successors + 1) * sizeof(UINT64)) / WAYS * WAYS;
+      return entries > WAYS ? entries : WAYS;
+    }
+    UINT64 *getSlots(const MarkovEntry *entry) {return slots.data() + table.getIndex(entry) * successors;}
+
+  public:
+    MarkovPrefetcher(UINT64 budget, int succ): successors(succ), table(entriesFor(budget, succ), WAYS),
+                  slots(UINT64(table.getEntries()) * succ, 0) {}
+
+    UINT64 getMetadataBytes() const {return table.getEntries() * sizeof(UINT64) + slots.size() * sizeof(UINT64);} // block tags and successors
+
+    void prefetch(ADDRINT addr, ADDRINT loadPC) {
+      MarkovEntry *entry = table.find(addr / blockSize);
+      if (entry == NULL) return;
+      UINT64 *next = getSlots(entry);
+      for (int i = 0; i < entry->count && i < degree; i++) issuePrefetch(next[i] * blockSize);
+    }
+
+    void train(ADDRINT addr, ADDRINT loadPC) {
+      UINT64 block = addr / blockSize;
+      if (havePrev && block != prevBlock) {
+        MarkovEntry *entry = table.find(prevBlock);
+        if (entry == NULL) entry = table.insert(prevBlock);
+        UINT64 *next = getSlots(entry);
+        int pos = 0;
+        while (pos < entry->count && next[pos] != block) pos++;
+        if (pos == entry->count) { // new successor, the least recent one is dropped when full
+          if (entry->count < successors) entry->count++;
+          pos = entry->count - 1;
+        }
+        for (int i = pos; i > 0; i--) next[i] = next[i - 1];
+        next[0] = block;
+      }
+      prevBlock = block;
+      havePrev = true;
+    }
+};
+
+/* ===================================================================== */
+
+/* Feedback Directed Prefetching (Srinath et al., HPCA 2007)
+    Every -fdp_interval accesses the accuracy, lateness and pollution of each prefetcher
+    during the interval are folded into running averages (half old, half new), and the
+    prefetcher moves one level up or down the aggressiveness table below.
+    Level 3 is the static -aggr configuration. A prefetch is late when a demand access
+    merges with its MSHR, so -adaptive needs -mem_latency.
+*/
+class FeedbackThrottle {
+  private:
+    static const int LEVELS = 5;
+    static const double ACCURACY_HIGH, ACCURACY_LOW, LATENESS_THRESHOLD, POLLUTION_THRESHOLD;
+    struct Controlled {
+      PrefetcherInterface *prefetcher;
+      int id; // prefetcher id in the accounting
+      int level;
+      PrefetchCounters last;
+      double accuracy, lateness, pollution;
+    };
+    vector<Controlled> controlled;
+    UINT64 lastMisses = 0;
+    UINT64 increments = 0;
+    UINT64 decrements = 0;
+
+    void setLevel(Controlled &c, int level) {
+      int degree, distance;
+      c.level = level;
+      levelToAggressiveness(level, degree, distance);
+      c.prefetcher->setAggressiveness(degree, distance);
+    }
+
+  public:
+    // degree and distance of a level, scaled by the static aggression
+    static void levelToAggressiveness(int level, int &degree, int &distance) {
+      int half = aggression / 2 > 0 ? aggression / 2 : 1;
+      switch (level) {
+        case 1: degree = 1; distance = 1; break;
+        case 2: degree = half; distance = 1; break;
+        case 3: degree = aggression; distance = 1; break;
+        case 4: degree = aggression; distance = 1 + half; break;
+        default: degree = 2 * aggression; distance = 1 + aggression; break;
+      }
+    }
+
+    // The furthest prediction any level reaches, distance - 1 + degree
+    static const int maxLookahead() {
+      int furthest = 0;
+      for (int level = 1; level <= LEVELS; level++) {
+        int degree, distance;
+        levelToAggressiveness(level, degree, distance);
+        furthest = max(furthest, distance - 1 + degree);
+      }
+      return furthest;
+    }
+
+    void addPrefetcher(PrefetcherInterface *pf, int id) {
+      Controlled c = {pf, id, 3, accounting->counters(id), 0.0, 0.0, 0.0};
+      controlled.push_back(c);
+      setLevel(controlled.back(), 3);
+    }
+
+    // End of an interval: update the averages and adapt every prefetcher
+    void sample(UINT64 demandMisses) {
+      UINT64 misses = demandMisses - lastMisses;
+      lastMisses = demandMisses;
+      for (uint i = 0; i < controlled.size(); i++) {
+        Controlled &c = controlled.at(i);
+        const PrefetchCounters &now = accounting->counters(c.id);
+        UINT64 issued = now.issued - c.last.issued;
+        UINT64 useful = now.useful() - c.last.useful();
+        UINT64 late = now.late - c.last.late;
+        UINT64 pollution = now.pollution - c.last.pollution;
+        c.last = now;
+        if (issued == 0) continue; // nothing to judge, e.g. a prefetcher still training
+        c.accuracy = (c.accuracy + double(useful) / issued) / 2;
+        c.lateness = (c.lateness + (useful ? double(late) / useful : 0.0)) / 2;
+        c.pollution = (c.pollution + (misses ? double(pollution) / misses : 0.0)) / 2;
+
+        bool isLate = c.lateness > LATENESS_THRESHOLD;
+        bool polluting = c.pollution > POLLUTION_THRESHOLD;
+        int change = 0;
+        if (c.accuracy >= ACCURACY_HIGH) change = isLate ? 1 : (polluting ? -1 : 0);
+        else if (c.accuracy >= ACCURACY_LOW) change = isLate ? (polluting ? -1 : 1) : (polluting ? -1 : 0);
+        else change = (isLate || polluting) ? -1 : 0;
+        int level = c.level + change;
+        if (level < 1 || level > LEVELS) continue;
+        if (change > 0) increments++;
+        if (change < 0) decrements++;
+        if (change != 0) setLevel(c, level);
+      }
+    }
+
+    void print(ostream &out) const {
+      for (uint i = 0; i < controlled.size(); i++) {
+        const Controlled &c = controlled.at(i);
+        out << "Prefetch aggressiveness: level " << c.level << " (degree " << c.prefetcher->getDegree() << ", distance "
+            << c.prefetcher->getDistance() << ") Accuracy: " << c.accuracy << " Lateness: " << c.lateness << " Pollution: " << c.pollution << endl;
+      }
+      out << "Aggressiveness increments: " << increments << " decrements: " << decrements << endl;
+    }
+};
+
+const double FeedbackThrottle::ACCURACY_HIGH = 0.75;
+const double FeedbackThrottle::ACCURACY_LOW = 0.40;
+const double FeedbackThrottle::LATENESS_THRESHOLD = 0.01;
+const double FeedbackThrottle::POLLUTION_THRESHOLD = 0.005;
+
+FeedbackThrottle *throttle = NULL;
+UINT64 fdpInterval;
+bool trainStores = false;
+bool observeAccesses = false; // the prefetcher sees every demand access through observe()
+
+/* ===================================================================== */
+
+/* Composite Prefetcher
+    Runs several prefetchers, given as -pref_type a+b+..., on every trigger. Their candidates
+    are collected instead of issued, duplicates are merged, and the rest are issued in order
+    of the confidence of the prefetcher that proposed them (its accuracy so far) until the
+    shared budget of -issue_budget prefetches per trigger is spent.
+*/
+class CompositePrefetcher : public PrefetcherInterface, public PrefetchCollector {
+  private:
+    struct Component {
+      string name;
+      PrefetcherInterface *prefetcher;
+      int id; // prefetcher id in the accounting
+      UINT64 proposed, duplicates, overBudget;
+    };
+    struct Candidate {
+      UINT64 addr;
+      double confidence;
+      int component;
+    };
+    vector<Component> components;
+    vector<Candidate> candidates;
+    vector<UINT64> seen; // blocks already arbitrated for the current trigger
+    int current = 0; // component whose candidates are being collected
+    UINT32 budget;
+
+    static bool moreConfident(const Candidate &a, const Candidate &b) {return a.confidence > b.confidence;}
+
+  public:
+    CompositePrefetcher(UINT32 issueBudget): budget(issueBudget) {}
+
+    void addComponent(const string &name, PrefetcherInterface *pf) {
+      Component c = {name, pf, accounting->addPrefetcher(name), 0, 0, 0};
+      components.push_back(c);
+    }
+
+    void addComponentsTo(FeedbackThrottle *fdp) {
+      for (uint i = 0; i < components.size(); i++) fdp->addPrefetcher(components.at(i).prefetcher, components.at(i).id);
+    }
+
+    // The confidence of a candidate is the accuracy of its component so far, starting from one half
+    void propose(UINT64 addr) {
+      const PrefetchCounters &c = accounting->counters(components.at(current).id);
+      Candidate candidate = {addr, (c.useful() + 1.0) / (c.issued + 2.0), current};
+      candidates.push_back(candidate);
+      components.at(current).proposed++;
+    }
+
+    void prefetch(ADDRINT addr, ADDRINT loadPC) {
+      candidates.clear();
+      collector = this;
+      for (current = 0; current < (int)components.size(); current++) components.at(current).prefetcher->prefetch(addr, loadPC);
+      collector = NULL;
+      stable_sort(candidates.begin(), candidates.end(), moreConfident);
+      seen.clear();
+      UINT32 issued = 0;
+      for (uint i = 0; i < candidates.size(); i++) {
+        Component &c = components.at(candidates.at(i).component);
+        UINT64 block = candidates.at(i).addr / blockSize;
+        if (find(seen.begin(), seen.end(), block) != seen.end()) {
+          c.duplicates++;
+          continue;
+        }
+        seen.push_back(block);
+        if (budget > 0 && issued == budget) {
+          c.overBudget++;
+          continue;
+        }
+        accounting->setPrefetcher(c.id);
+        if (issuePrefetch(candidates.at(i).addr)) issued++;
+      }
+    }
+
+    void train(ADDRINT addr, ADDRINT loadPC) {
+      for (uint i = 0; i < components.size(); i++) components.at(i).prefetcher->train(addr, loadPC);
+    }
+
+    const bool observes() const {
+      for (uint i = 0; i < components.size(); i++) if (components.at(i).prefetcher->observes()) return true;
+      return false;
+    }
+
+    void observe(ADDRINT addr, ADDRINT loadPC) {
+      for (uint i = 0; i < components.size(); i++) components.at(i).prefetcher->observe(addr, loadPC);
+    }
+
+    UINT64 getMetadataBytes() const {
+      UINT64 bytes = 0;
+      for (uint i = 0; i < components.size(); i++) bytes += components.at(i).prefetcher->getMetadataBytes();
+      return bytes;
+    }
+
+    void print(ostream &out) const {
+      for (uint i = 0; i < components.size(); i++) {
+        const Component &c = components.at(i);
+        out << "Component " << c.name << ": proposed " << c.proposed << " duplicates " << c.duplicates << " over budget " << c.overBudget
+            << " issued " << accounting->counters(c.id).issued << " useful " << accounting->counters(c.id).useful() << endl;
+      }
+    }
+};
+
+CompositePrefetcher *composite = NULL;
+
+/* ===================================================================== */
+
+// Create a single prefetcher from its -pref_type name
+PrefetcherInterface *createPrefetcher(const string &name)
+{
+    if (name == "none") {
+        return new NonePrefetcher();
+    } else if (name == "next_n_lines") {
+        return new NextNLinePrefetcher();
+    } else if (name == "stride") {
+        if (KnobRPTWays.Value() == 0 || KnobRPTEntries.Value() < KnobRPTWays.Value() || KnobRPTEntries.Value() % KnobRPTWays.Value() != 0) {
+            std::cerr << "Error: -rpt_entries must be a non-zero multiple of -rpt_ways. Simulation will be terminated." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        return new StridePrefetcher(KnobRPTEntries.Value(), KnobRPTWays.Value());
+    } else if (name == "distance") {
+        if (KnobDistWays.Value() == 0 || KnobDistEntries.Value() < KnobDistWays.Value() || KnobDistEntries.Value() % KnobDistWays.Value() != 0) {
+            std::cerr << "Error: -dist_entries must be a non-zero multiple of -dist_ways. Simulation will be terminated." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        return new DistancePrefetcher(KnobDistEntries.Value(), KnobDistWays.Value(),
+                                      KnobAdaptive.Value() ? FeedbackThrottle::maxLookahead() : aggression);
+    } else if (name == "best_offset") {
+        return new BestOffsetPrefetcher();
+    } else if (name == "sandbox") {
+        return new SandboxPrefetcher();
+    } else if (name == "sms") {
+        if (KnobSMSRegion.Value() < (UINT32)blockSize || KnobSMSRegion.Value() % blockSize != 0 || KnobSMSAGTEntries.Value() == 0 ||
+            KnobSMSPHTWays.Value() == 0 || KnobSMSPHTEntries.Value() < KnobSMSPHTWays.Value() || KnobSMSPHTEntries.Value() % KnobSMSPHTWays.Value() != 0) {
+            std::cerr << "Error: -sms_region must be a multiple of the block size and -sms_pht_entries a multiple of -sms_pht_ways. Simulation will be terminated." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        return new SMSPrefetcher(KnobSMSRegion.Value(), KnobSMSAGTEntries.Value(), KnobSMSPHTEntries.Value(), KnobSMSPHTWays.Value());
+    } else if (name == "markov") {
+        if (KnobMarkovSuccessors.Value() == 0) {
+            std::cerr << "Error: The markov prefetcher needs at least one successor per entry. Simulation will be terminated." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        return new MarkovPrefetcher(UINT64(KnobMarkovBudget.Value()) * 1024, KnobMarkovSuccessors.Value());
+    }
+    std::cerr << "Error: No such type of prefetcher. Simulation will be terminated." << std::endl;
+    std::exit(EXIT_FAILURE);
+}
+
+/* ===================================================================== */
+
+//---------------------------------------------------------------------
+//##############################################
+/*
+ * Your changes here.
+ *
+ * Put your prefetcher implementation here
+ *
+ * Example:
+ *
+ * class StridePrefetcher : public PrefetcherInterface {
+ * private:
+ *  // set up private members
+ *
+ * public:
+ *  void prefetch(ADDRINT addr, ADDRINT loadPC) {
+ *      // Prefetcher implementation
+ *  }
+ *
+ *  void train(ADDRINT addr, ADDRINT loadPC) {
+ *      // Training implementation
+ *  }
+ * };
+ *
+ * You can modify the functions Load() and Store() where necessary to implement your functionality
+ *
+ * DIRECTIONS ON USING THE COMMAND LINE ARGUMENT
+ *    The string variable "prefetcherName" indicates the name of the prefetcher that is passed as a command line argument (-pref_type)
+ *    The integer variable "aggression" indicates the aggressiveness indicated by the command line argument (-aggr)
+ *    Prefetchers issue "degree" prefetches starting "distance" ahead; both start from aggression and are adapted at runtime by FeedbackThrottle with -adaptive
+ *
+ * STATS:
+ * ***Note that these exist to help you debug your program and produce your graphs
+ *  The member function Cache::getSuccessfulPrefs() returns how many of the prefetched block into the cache were actually used, credited on their first hit. This applies in  the case where no prefetch buffer is used.
+ *  With -pref_buffer fa|stream, PrefetchBuffer::getPrefHits() returns how many of the buffered blocks were promoted into the cache by a demand access
+ *  With -mem_latency, prefetches wait in the MSHRs (InFlightQueue) and a demand access to an in-flight block counts as a late prefetch
+ *  With -tlb, TLBHierarchy (tlb) counts the DTLB and STLB misses and the page walk cycles of the demand accesses
+ *  With -page_map, PageMapper (pageMap) translates the demand accesses to physical addresses and prefetches into unmapped pages are dropped
+ *  PrefetchAccounting (accounting) follows every prefetched block and reports accuracy, coverage, lateness and pollution per prefetcher and per load PC
+ *  DemandProfile (demandProfile) counts the demand misses, covered and late misses of every load PC and lists the delinquent loads with -delinquent
+ *  The integer variable "prefetches" should count the number of prefetched blocks
+ *  The integer variable "accesses" counts the number of memory accesses performed by the program
+ *  The integer variable "hits" counts the number of memory accesses that actually hit in either the data cache or the prefetch buffer such that hits = cacheHits + prefHits
+ *
+ */
+//##############################################
+//---------------------------------------------------------------------
+
+
+/* ===================================================================== */
+
+/* Action taken on a load. Load takes 2 arguments:
+    addr: the address of the demanded block (in bytes)
+    pc: the program counter of the load instruction
+*/
+// Run the prefetcher on a demand access if -train_on selects it: every miss, plus the first hit
+// on each prefetched block or every hit, so that an accurate prefetcher keeps running ahead of its stream
+const bool isTrigger(bool hit, bool prefetchedHit)
+{
+  return !hit || trainOn == TRAIN_ON_ALL || (prefetchedHit && trainOn == TRAIN_ON_PREFETCHED_HIT);
+}
+
+void trigger(ADDRINT addr, ADDRINT pc, bool hit, bool prefetchedHit)
+{
+  if (observeAccesses) prefetcher->observe(addr, pc);
+  if (!isTrigger(hit, prefetchedHit)) return;
+  triggers++;
+  accounting->setTriggerPC(pc);
+  prefetcher->prefetch(addr, pc);
+  prefetcher->train(addr, pc);
+}
+
+/* ===================================================================== */
+
+void Load(ADDRINT addr, ADDRINT pc)
+{
+  ADDRINT vaddr = addr;
+  if (pageMap) addr = pageMap->translate(addr);
+  if (tlb) tlb->access(vaddr);
+  if (idealHugeTLB) idealHugeTLB->access(vaddr);
+  for (uint i = 0; i < stackProfilers.size(); i++) stackProfilers[i]->access(addr);
+  int sample = sampler ? sampler->sampleOf(addr) : 0;
+  if (sample < 0) {
+    sampler->filtered();
+    return;
+  }
+  accesses++;
+  loads++;
+  if (mshr) completePrefetches();
+  bool cacheHit = cache->probeTag(addr); // Use the function Cache::probeTag(UINT64) when you are probing the cache after a demand access
+  bool prefetchedHit = cacheHit && cache->hitPrefetched();
+  bool hit = cacheHit;
+  bool late = false;
+  if (!hit) {
+    hit = prefetchedHit = prefBuffer && prefBuffer->probeTag(addr); // the block is promoted from the prefetch buffer by the fill below
+    late = !hit && mshr && mshr->remove(addr);
+    if (late) accounting->late(addr); // the demand merges with the prefetch still in flight
+    cache->fillLine(addr); // Use the member function Cache::fillLine(addr) when you fill in the MRU way for demand accesses
+  }
+  trigger(vaddr, pc, cacheHit, prefetchedHit); // a prefetch buffer hit is a d-cache miss, which lets a stream buffer extend its stream
+  if (hit) hits++;
+  if (demandProfile) demandProfile->access(pc, hit, prefetchedHit, late);
+  if (sampler) sampler->access(sample, hit, prefetchedHit);
+  if (shadowCache) shadowAccess(addr, !hit);
+  if (throttle && accesses % fdpInterval == 0) throttle->sample(accesses - hits);
+  if (accesses % checkpoint == 0)  takeCheckPoint();
+}
+
+/* ===================================================================== */
+
+//Action taken on a store
+void Store(ADDRINT addr, ADDRINT pc)
+{
+  ADDRINT vaddr = addr;
+  if (pageMap) addr = pageMap->translate(addr);
+  if (tlb) tlb->access(vaddr);
+  if (idealHugeTLB) idealHugeTLB->access(vaddr);
+  for (uint i = 0; i < stackProfilers.size(); i++) stackProfilers[i]->access(addr);
+  int sample = sampler ? sampler->sampleOf(addr) : 0;
+  if (sample < 0) {
+    sampler->filtered();
+    return;
+  }
+  accesses++;
+  stores++;
+  if (mshr) completePrefetches();
+  bool cacheHit = cache->probeTag(addr);
+  bool prefetchedHit = cacheHit && cache->hitPrefetched();
+  bool hit = cacheHit;
+  bool late = false;
+  if (!hit) {
+    hit = prefetchedHit = prefBuffer && prefBuffer->probeTag(addr);
+    late = !hit && mshr && mshr->remove(addr);
+    if (late) accounting->late(addr);
+    cache->fillLine(addr);
+  }
+  if (trainStores) trigger(vaddr, pc, cacheHit, prefetchedHit);
+  if (hit) hits++;
+  if (sampler) sampler->access(sample, hit, prefetchedHit);
+  if (shadowCache) shadowAccess(addr, !hit);
+  if (throttle && accesses % fdpInterval == 0) throttle->sample(accesses - hits);
+  if (accesses % checkpoint == 0) takeCheckPoint();
+}
+
+/* ===================================================================== */
+
+// Accesses of up to this many bytes, and no larger than a block, call Load() and Store() directly when they
+// do not cross a block, which is checked inline by fitsLine() and crossesLine(); the larger ones always
+// go through LoadMulti() and StoreMulti()
+const UINT32 SINGLE_LINE_ACCESS_SIZE = 8;
+
+ADDRINT fitsLine(ADDRINT addr, UINT32 size) {return addr % blockSize + size <= UINT64(blockSize);}
+ADDRINT crossesLine(ADDRINT addr, UINT32 size) {return addr % blockSize + size > UINT64(blockSize);}
+
+/* Action taken on a load or a store of size bytes that may span several blocks: every block
+    it touches is a separate access to the cache, in address order
+*/
+void LoadMulti(ADDRINT addr, UINT32 size, ADDRINT pc)
+{
+  UINT64 last = (addr + size - 1) / blockSize;
+  if (size == 0 || addr / blockSize == last) {
+    Load(addr, pc);
+    return;
+  }
+  splitAccesses++;
+  Load(addr, pc);
+  for (UINT64 block = addr / blockSize + 1; block <= last; block++) Load(block * blockSize, pc);
+}
+
+void StoreMulti(ADDRINT addr, UINT32 size, ADDRINT pc)
+{
+  UINT64 last = (addr + size - 1) / blockSize;
+  if (size == 0 || addr / blockSize == last) {
+    Store(addr, pc);
+    return;
+  }
+  splitAccesses++;
+  Store(addr, pc);
+  for (UINT64 block = addr / blockSize + 1; block <= last; block++) Store(block * blockSize, pc);
+}
+
+/* ===================================================================== */
+
+// Create the cache, the prefetcher and the rest of the model from the knobs
+void setupSimulation()
+{
+    // Initialize stats
+    hits = 0;
+    accesses = 0;
+    prefetches = 0;
+    droppedPrefetches = 0;
+    unmappedPrefetches = 0;
+    shadowMisses = 0;
+    triggers = 0;
+    splitAccesses = 0;
+    loads = 0;
+    stores = 0;
+    aggression = KnobAggression.Value();
+    sets = KnobCacheSets.Value();
+    associativity = KnobAssociativity.Value();
+    blockSize =  KnobLineSize.Value();
+    prefetcherName = KnobPrefetcherName;
+
+    // create a data cache, unless the Pin tool simulates one per shard
+    accounting = new PrefetchAccounting(blockSize, 4 * UINT64(sets) * associativity);
+    if (!shardCount) {
+        cache = new Cache(sets, associativity, blockSize);
+        cache->setListener(accounting);
+        if (KnobPollution.Value()) shadowCache = new Cache(sets, associativity, blockSize);
+    }
+
+    if (prefetcherName.find('+') == string::npos) {
+        prefetcher = createPrefetcher(prefetcherName);
+        accounting->addPrefetcher(prefetcherName);
+    } else { // several prefetchers, e.g. stride+next_n_lines
+        composite = new CompositePrefetcher(KnobIssueBudget.Value());
+        size_t begin = 0;
+        while (begin <= prefetcherName.size()) {
+            size_t end = prefetcherName.find('+', begin);
+            if (end == string::npos) end = prefetcherName.size();
+            string name = prefetcherName.substr(begin, end - begin);
+            composite->addComponent(name, createPrefetcher(name));
+            begin = end + 1;
+        }
+        prefetcher = composite;
+    }
+    observeAccesses = prefetcher->observes();
+
+    if (KnobTrainOn.Value() == "miss") {
+        trainOn = TRAIN_ON_MISS;
+    } else if (KnobTrainOn.Value() == "prefetched_hit") {
+        trainOn = TRAIN_ON_PREFETCHED_HIT;
+    } else if (KnobTrainOn.Value() == "all") {
+        trainOn = TRAIN_ON_ALL;
+    } else {
+        std::cerr << "Error: -train_on must be miss, prefetched_hit or all. Simulation will be terminated." << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    trainStores = KnobTrainStores.Value();
+
+    if (KnobPrefBufferEntries.Value() == 0 || KnobStreamBuffers.Value() == 0 || KnobStreamBufferDepth.Value() == 0) {
+        std::cerr << "Error: The prefetch buffers need at least one entry. Simulation will be terminated." << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    if (KnobPrefetchBuffer.Value() == "fa") {
+        prefBuffer = new FullyAssociativePrefetchBuffer(KnobPrefBufferEntries.Value(), blockSize);
+    } else if (KnobPrefetchBuffer.Value() == "stream") {
+        prefBuffer = new StreamBuffers(KnobStreamBuffers.Value(), KnobStreamBufferDepth.Value(), blockSize);
+    }
+    if (prefBuffer) {
+        prefBuffer->setListener(accounting);
+    } else if (KnobPrefetchBuffer.Value() != "none") {
+        std::cerr << "Error: No such type of prefetch buffer. Simulation will be terminated." << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    if (KnobAdaptive.Value()) {
+        if (KnobFDPInterval.Value() == 0) {
+            std::cerr << "Error: -fdp_interval must be at least one access. Simulation will be terminated." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        if (KnobMemLatency.Value() == 0) { // the lateness of the prefetches is only known with MSHRs
+            std::cerr << "Error: -adaptive needs a -mem_latency above 0. Simulation will be terminated." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        fdpInterval = KnobFDPInterval.Value();
+        throttle = new FeedbackThrottle();
+        if (composite) composite->addComponentsTo(throttle);
+        else throttle->addPrefetcher(prefetcher, 0);
+    }
+
+    if (KnobSampleSets.Value() > 0) {
+        if (KnobSampleSets.Value() > UINT32(sets) || (KnobSampleMode.Value() != "stride" && KnobSampleMode.Value() != "hash")) {
+            std::cerr << "Error: -sample_sets must be at most -sets and -sample_mode stride or hash. Simulation will be terminated." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        sampler = new SetSampler(sets, blockSize, KnobSampleSets.Value(), KnobSampleMode.Value() == "hash");
+    }
+
+    if (KnobStackDistance.Value()) {
+        UINT64 maxBlocks = KnobSDMaxBlocks.Value();
+        stackProfilers.push_back(new StackDistanceProfiler(1, blockSize, maxBlocks));
+        const string &list = KnobSDSets.Value();
+        size_t begin = 0;
+        while (begin < list.size()) {
+            size_t end = list.find(',', begin);
+            if (end == string::npos) end = list.size();
+            UINT32 sdSets = atoi(list.substr(begin, end - begin).c_str());
+            if (sdSets == 0) {
+                std::cerr << "Error: -sd_sets must be a list of set counts. Simulation will be terminated." << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+            stackProfilers.push_back(new StackDistanceProfiler(sdSets, blockSize, max<UINT64>(maxBlocks / sdSets, 1)));
+            begin = end + 1;
+        }
+    }
+
+    if (KnobPageMap.Value() != "none") {
+        static const char *policies[] = {"sequential", "random", "colored", "huge"};
+        int policy = 0;
+        while (policy < 4 && KnobPageMap.Value() != policies[policy]) policy++;
+        if (policy == 4) {
+            std::cerr << "Error: No such page mapping. Simulation will be terminated." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        UINT32 colors = KnobPageColors.Value() ? KnobPageColors.Value() : max<UINT64>(UINT64(sets) * blockSize / 4096, 1);
+        pageMap = new PageMapper(PageMapper::Policy(policy), UINT64(KnobPhysMem.Value()) << 20, colors);
+    }
+
+    if (KnobTLB.Value()) {
+        UINT32 pageSize = KnobTLBPageSize.Value() ? KnobTLBPageSize.Value() : (pageMap ? pageMap->pageSize() : 4096);
+        UINT32 pageShift = 0;
+        while ((UINT64(1) << pageShift) < pageSize) pageShift++;
+        if ((pageShift != 12 && pageShift != 21 && pageShift != 30) || UINT64(1) << pageShift != pageSize) {
+            std::cerr << "Error: The TLB pages must be 4KB, 2MB or 1GB. Simulation will be terminated." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        if (KnobDTLBWays.Value() == 0 || KnobSTLBWays.Value() == 0 || KnobPSCEntries.Value() == 0 ||
+            KnobDTLBEntries.Value() % KnobDTLBWays.Value() != 0 || KnobSTLBEntries.Value() % KnobSTLBWays.Value() != 0) {
+            std::cerr << "Error: The TLB entries must be a non-zero multiple of their ways. Simulation will be terminated." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        tlb = new TLBHierarchy(KnobDTLBEntries.Value(), KnobDTLBWays.Value(), KnobSTLBEntries.Value(), KnobSTLBWays.Value(), pageShift,
+                               KnobPSCEntries.Value(), KnobSTLBLatency.Value(), KnobWalkLatency.Value());
+        if (KnobTLBIdealHuge.Value()) {
+            idealHugeTLB = new TLBHierarchy(KnobDTLBEntries.Value(), KnobDTLBWays.Value(), KnobSTLBEntries.Value(), KnobSTLBWays.Value(), 21,
+                                            KnobPSCEntries.Value(), KnobSTLBLatency.Value(), KnobWalkLatency.Value());
+        }
+    }
+
+    if (KnobDelinquent.Value() > 0 && !shardCount) demandProfile = new DemandProfile();
+
+    if (KnobMemLatency.Value() > 0) {
+        if (KnobMSHREntries.Value() == 0) {
+            std::cerr << "Error: A memory latency needs at least one MSHR. Simulation will be terminated." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        mshr = new InFlightQueue(KnobMSHREntries.Value(), KnobMemLatency.Value(), blockSize);
+    }
+
+    outFile.open(KnobOutputFile.Value());
+}
+
+/* ===================================================================== */
+
+// Final stats, printed when the program or the trace ends
+void reportSimulation()
+{
+    outFile << "The program has completed execution" << endl;
+    takeCheckPoint();
+    if (throttle) throttle->print(outFile);
+    if (composite) composite->print(outFile);
+    accounting->printPerPC(outFile, KnobPCReport.Value());
+    if (demandProfile) demandProfile->print(outFile, KnobDelinquent.Value(), accounting, pcName);
+    for (uint i = 0; i < stackProfilers.size(); i++) stackProfilers.at(i)->print(outFile);
+}
+
+#endif
+
+/* ===================================================================== */
+/* eof */
+/* ===================================================================== */
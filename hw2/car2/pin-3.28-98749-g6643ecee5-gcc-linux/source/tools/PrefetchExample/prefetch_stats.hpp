@@ -0,0 +1,278 @@
+#ifndef PREFETCH_STATS_H
+#define PREFETCH_STATS_H
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dcache_for_prefetcher.hpp"
+#include "prefetch_tables.hpp"
+
+using namespace std;
+
+/* ===================================================================== */
+
+// Outcome counters of the prefetches issued by one prefetcher or one load PC
+struct PrefetchCounters {
+  PrefetchCounters(): issued(0), used(0), late(0), useless(0), pollution(0) {}
+  const UINT64 useful() const {return used + late;}
+  UINT64 issued;
+  UINT64 used;      // demanded after the block had arrived
+  UINT64 late;      // demanded while the block was still in flight
+  UINT64 useless;   // left the cache or the prefetch buffer without being demanded
+  UINT64 pollution; // demand misses on blocks that a prefetch of this prefetcher evicted
+};
+
+/* ===================================================================== */
+
+// Tracks every prefetched block from its issue until it is used or evicted and
+// attributes the outcome to the prefetcher and the load PC that triggered it.
+// Pollution misses are detected by the caller with a shadow tag directory that only
+// sees demand accesses; the demand blocks evicted by prefetch fills are remembered
+// here so that such a miss can be charged to the prefetcher whose fill evicted them,
+// which with MSHRs is not the one arbitrated last when the fill arrives.
+class PrefetchAccounting : public PrefetchEventListener {
+public:
+  PrefetchAccounting(const int blockSize, const UINT64 victimCapacity): _blockSize(blockSize), _victimCapacity(victimCapacity),
+                  _prefetcher(0), _evictor(0), _triggerPC(0) {}
+  const int addPrefetcher(const string &name);
+  void setPrefetcher(const int prefetcher) {_prefetcher = prefetcher;}
+  void setTriggerPC(const UINT64 pc) {_triggerPC = pc;}
+  void setEvictor(const int prefetcher) {_evictor = prefetcher;}
+  const int getPrefetcher() const {return _prefetcher;}
+  const UINT64 getTriggerPC() const {return _triggerPC;}
+  void issued(const UINT64 addr);
+  void filling(const UINT64 addr);
+  void late(const UINT64 addr);
+  void pollutionMiss(const UINT64 addr);
+  void prefetchUsed(const UINT64 addr);
+  void prefetchUnused(const UINT64 addr);
+  void demandBlockEvicted(const UINT64 addr);
+  const PrefetchCounters &total() const {return _total;}
+  const PrefetchCounters &counters(const int prefetcher) const {return _perPrefetcher.at(prefetcher);}
+  const UINT64 pending() const {return _pending.size();}
+  const PrefetchCounters *countersOfPC(const UINT64 pc) const {return _perPC.find(pc);}
+  void print(ostream &out, const UINT64 demandMisses) const;
+  void printPerPC(ostream &out, const UINT32 maxPCs) const;
+private:
+  struct Source {
+    int prefetcher;
+    UINT64 pc;
+  };
+  const bool take(const UINT64 addr, Source &src);
+  void printCounters(ostream &out, const PrefetchCounters &c, const UINT64 demandMisses) const;
+  unordered_map<UINT64, Source> _pending;  // prefetched blocks neither used nor evicted yet
+  unordered_map<UINT64, int> _victims;     // demand blocks evicted by a prefetch fill, and the prefetcher that did it
+  vector<string> _names;
+  vector<PrefetchCounters> _perPrefetcher;
+  PCTable<PrefetchCounters> _perPC;
+  PrefetchCounters _total;
+  UINT64 _blockSize;
+  UINT64 _victimCapacity;
+  int _prefetcher;
+  int _evictor; // prefetcher of the block being filled
+  UINT64 _triggerPC;
+};
+
+/* ===================================================================== */
+
+// Register a prefetcher and return the id used by setPrefetcher()
+const int PrefetchAccounting::addPrefetcher(const string &name)
+{
+  _names.push_back(name);
+  _perPrefetcher.push_back(PrefetchCounters());
+  return _names.size() - 1;
+}
+
+/* ===================================================================== */
+
+// Record a prefetch issued by the current prefetcher for the current trigger PC
+void PrefetchAccounting::issued(const UINT64 addr)
+{
+  Source src = {_prefetcher, _triggerPC};
+  _pending[addr / _blockSize] = src;
+  _total.issued++;
+  _perPrefetcher.at(_prefetcher).issued++;
+  _perPC[_triggerPC].issued++;
+}
+
+/* ===================================================================== */
+
+// A prefetched block is about to be filled: its prefetcher is charged for the demand blocks the fill evicts
+void PrefetchAccounting::filling(const UINT64 addr)
+{
+  unordered_map<UINT64, Source>::const_iterator it = _pending.find(addr / _blockSize);
+  _evictor = it != _pending.end() ? it->second.prefetcher : _prefetcher;
+}
+
+/* ===================================================================== */
+
+// Remove a block from the pending prefetches and return who prefetched it
+const bool PrefetchAccounting::take(const UINT64 addr, Source &src)
+{
+  unordered_map<UINT64, Source>::iterator it = _pending.find(addr / _blockSize);
+  if (it == _pending.end()) return false;
+  src = it->second;
+  _pending.erase(it);
+  return true;
+}
+
+/* ===================================================================== */
+
+void PrefetchAccounting::prefetchUsed(const UINT64 addr)
+{
+  Source src;
+  if (!take(addr, src)) return;
+  _total.used++;
+  _perPrefetcher.at(src.prefetcher).used++;
+  _perPC[src.pc].used++;
+}
+
+/* ===================================================================== */
+
+void PrefetchAccounting::late(const UINT64 addr)
+{
+  Source src;
+  if (!take(addr, src)) return;
+  _total.late++;
+  _perPrefetcher.at(src.prefetcher).late++;
+  _perPC[src.pc].late++;
+}
+
+/* ===================================================================== */
+
+void PrefetchAccounting::prefetchUnused(const UINT64 addr)
+{
+  Source src;
+  if (!take(addr, src)) return;
+  _total.useless++;
+  _perPrefetcher.at(src.prefetcher).useless++;
+  _perPC[src.pc].useless++;
+}
+
+/* ===================================================================== */
+
+// Remember which prefetcher evicted a demanded block; the table is simply
+// cleared when it outgrows its capacity, so old victims are forgotten
+void PrefetchAccounting::demandBlockEvicted(const UINT64 addr)
+{
+  if (_victims.size() >= _victimCapacity) _victims.clear();
+  _victims[addr / _blockSize] = _evictor;
+}
+
+/* ===================================================================== */
+
+// A demand miss that would have hit without prefetching
+void PrefetchAccounting::pollutionMiss(const UINT64 addr)
+{
+  _total.pollution++;
+  unordered_map<UINT64, int>::iterator it = _victims.find(addr / _blockSize);
+  if (it == _victims.end()) return;
+  _perPrefetcher.at(it->second).pollution++;
+  _victims.erase(it);
+}
+
+/* ===================================================================== */
+
+// Print accuracy, coverage, lateness and pollution of one set of counters
+void PrefetchAccounting::printCounters(ostream &out, const PrefetchCounters &c, const UINT64 demandMisses) const
+{
+  out << "Issued: " << c.issued << " Used: " << c.used << " Late: " << c.late << " Useless: " << c.useless << endl;
+  out << "  Accuracy: " << (c.issued ? double(c.useful()) / double(c.issued) : 0.0)
+      << " Coverage: " << (_total.used + demandMisses ? double(c.used) / double(_total.used + demandMisses) : 0.0)
+      << " Lateness: " << (c.useful() ? double(c.late) / double(c.useful()) : 0.0)
+      << " Pollution: " << (demandMisses ? double(c.pollution) / double(demandMisses) : 0.0) << endl;
+}
+
+/* ===================================================================== */
+
+// Print the totals followed by the metrics of every prefetcher
+void PrefetchAccounting::print(ostream &out, const UINT64 demandMisses) const
+{
+  out << "Prefetches ";
+  printCounters(out, _total, demandMisses);
+  out << "  Not yet used or evicted: " << _pending.size() << endl;
+  if (_names.size() < 2) return;
+  for (uint i = 0; i < _names.size(); i++) {
+    out << "Prefetcher " << _names.at(i) << ": ";
+    printCounters(out, _perPrefetcher.at(i), demandMisses);
+  }
+}
+
+/* ===================================================================== */
+
+// Print the load PCs that issued the most prefetches
+void PrefetchAccounting::printPerPC(ostream &out, const UINT32 maxPCs) const
+{
+  vector<pair<UINT64, UINT64> > order; // issued, pc
+  for (UINT64 slot = 0; slot < _perPC.slots(); slot++)
+    if (_perPC.used(slot)) order.push_back(make_pair(_perPC.valueAt(slot).issued, _perPC.pcAt(slot)));
+  sort(order.rbegin(), order.rend());
+  out << "Prefetches per load PC (top " << maxPCs << " by issued prefetches)" << endl;
+  for (uint i = 0; i < order.size() && i < maxPCs; i++) {
+    const PrefetchCounters &c = *_perPC.find(order.at(i).second);
+    out << "0x" << hex << order.at(i).second << dec << " Issued: " << c.issued << " Used: " << c.used << " Late: " << c.late
+        << " Useless: " << c.useless << " Accuracy: " << (c.issued ? double(c.useful()) / double(c.issued) : 0.0) << endl;
+  }
+}
+
+/* ===================================================================== */
+
+// Demand outcome counters of one load PC
+struct DemandCounters {
+  DemandCounters(): accesses(0), misses(0), covered(0), late(0) {}
+  UINT64 accesses;
+  UINT64 misses;
+  UINT64 covered; // first hits on prefetched blocks: misses the prefetcher removed
+  UINT64 late;    // misses on blocks whose prefetch was still in flight
+};
+
+// The demand loads of every PC, to find the delinquent loads: the PCs with the most misses; stores
+// are left out, as they rarely stall the core
+class DemandProfile {
+public:
+  void access(const UINT64 pc, const bool hit, const bool prefetchedHit, const bool late);
+  void print(ostream &out, const UINT32 maxPCs, const PrefetchAccounting *accounting, string (*pcName)(UINT64)) const;
+private:
+  PCTable<DemandCounters> _perPC;
+};
+
+/* ===================================================================== */
+
+void DemandProfile::access(const UINT64 pc, const bool hit, const bool prefetchedHit, const bool late)
+{
+  DemandCounters &c = _perPC[pc];
+  c.accesses++;
+  if (!hit) c.misses++;
+  if (prefetchedHit) c.covered++;
+  if (late) c.late++;
+}
+
+/* ===================================================================== */
+
+// Print the PCs with the most demand misses, with the useless prefetches they triggered and
+// their routine if pcName can tell it
+void DemandProfile::print(ostream &out, const UINT32 maxPCs, const PrefetchAccounting *accounting, string (*pcName)(UINT64)) const
+{
+  vector<pair<UINT64, UINT64> > order; // misses, pc
+  for (UINT64 slot = 0; slot < _perPC.slots(); slot++)
+    if (_perPC.used(slot)) order.push_back(make_pair(_perPC.valueAt(slot).misses, _perPC.pcAt(slot)));
+  sort(order.rbegin(), order.rend());
+  out << "Delinquent loads (top " << maxPCs << " of " << _perPC.size() << " by demand misses)" << endl;
+  for (uint i = 0; i < order.size() && i < maxPCs; i++) {
+    UINT64 pc = order.at(i).second;
+    const DemandCounters &c = *_perPC.find(pc);
+    const PrefetchCounters *p = accounting->countersOfPC(pc);
+    out << "0x" << hex << pc << dec;
+    if (pcName) out << " " << pcName(pc);
+    out << " Accesses: " << c.accesses << " Misses: " << c.misses << " Miss rate: " << double(c.misses) / double(c.accesses)
+        << " Covered: " << c.covered << " Late: " << c.late << " Useless prefetches: " << (p ? p->useless : 0) << endl;
+  }
+}
+
+#endif
+
+/* ===================================================================== */
+/* eof */
+/* ===================================================================== */
@@ -0,0 +1,191 @@
+#ifndef PREFETCH_TABLES_H
+#define PREFETCH_TABLES_H
+
+#include <vector>
+
+using namespace std;
+
+/* ===================================================================== */
+
+// Mix the bits of a key (load PC, address, distance) so that table sets are used evenly
+inline UINT64 hashKey(UINT64 key)
+{
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  return key;
+}
+
+/* ===================================================================== */
+
+// A set-associative table for prefetcher metadata, indexed by a hash of the key,
+// with true LRU replacement inside each set. ENTRY is the payload of a way; it is
+// value-initialized when a new key is inserted.
+template <class ENTRY>
+class SetAssocTable {
+public:
+  SetAssocTable(const int entries, const int ways);
+  ENTRY *find(const UINT64 key);
+  ENTRY *insert(const UINT64 key);
+  ENTRY *insert(const UINT64 key, bool &replaced, UINT64 &victimKey, ENTRY &victim);
+  const int getIndex(const ENTRY *entry) const {return entry - &_entries.at(0);}
+  const int getEntries() const {return _sets * _ways;}
+  const int getWays() const {return _ways;}
+private:
+  const int getSet(const UINT64 key) const {return hashKey(key) % _sets;}
+  vector<ENTRY> _entries;
+  vector<UINT64> _tags;
+  vector<bool> _validBits;
+  vector<UINT64> _lastUse; // LRU timestamps
+  UINT64 _clock;
+  int _sets;
+  int _ways;
+};
+
+/* ===================================================================== */
+
+template <class ENTRY>
+SetAssocTable<ENTRY>::SetAssocTable(const int entries, const int ways): _entries(entries), _tags(entries, 0), _validBits(entries, false),
+                _lastUse(entries, 0), _clock(0), _sets(entries / ways), _ways(ways)
+{
+}
+
+/* ===================================================================== */
+
+// Find the entry of a key and make it MRU; NULL if the key is not in the table
+template <class ENTRY>
+ENTRY *SetAssocTable<ENTRY>::find(const UINT64 key)
+{
+  int base = getSet(key) * _ways;
+  for (int i = base; i < base + _ways; i++) {
+    if (_validBits[i] && _tags[i] == key) {
+      _lastUse[i] = ++_clock;
+      return &_entries[i];
+    }
+  }
+  return NULL;
+}
+
+/* ===================================================================== */
+
+// Allocate a fresh MRU entry for a key, replacing an invalid or the LRU way of its set
+template <class ENTRY>
+ENTRY *SetAssocTable<ENTRY>::insert(const UINT64 key)
+{
+  bool replaced;
+  UINT64 victimKey;
+  ENTRY victim;
+  return insert(key, replaced, victimKey, victim);
+}
+
+/* ===================================================================== */
+
+// Same as insert(key), also handing back the key and payload of the valid entry that was replaced
+template <class ENTRY>
+ENTRY *SetAssocTable<ENTRY>::insert(const UINT64 key, bool &replaced, UINT64 &victimKey, ENTRY &victim)
+{
+  int base = getSet(key) * _ways;
+  int way = base;
+  for (int i = base; i < base + _ways; i++) {
+    if (!_validBits[i]) {
+      way = i;
+      break;
+    }
+    if (_lastUse[i] < _lastUse[way]) way = i;
+  }
+  replaced = _validBits[way];
+  if (replaced) {
+    victimKey = _tags[way];
+    victim = _entries[way];
+  }
+  _validBits[way] = true;
+  _tags[way] = key;
+  _lastUse[way] = ++_clock;
+  _entries[way] = ENTRY();
+  return &_entries[way];
+}
+
+/* ===================================================================== */
+
+// A hash map from a PC to its counters, kept compact by open addressing: the PCs and the values
+// share one array of slots that is probed linearly and doubles when it is half full.
+// slots(), used(), pcAt() and valueAt() visit the PCs in no particular order
+template <class VALUE>
+class PCTable {
+public:
+  PCTable(): _slots(64), _size(0) {}
+  VALUE &operator[](const UINT64 pc);
+  const VALUE *find(const UINT64 pc) const;
+  const UINT64 size() const {return _size;}
+  const UINT64 slots() const {return _slots.size();}
+  const bool used(const UINT64 slot) const {return _slots[slot].pc != EMPTY;}
+  const UINT64 pcAt(const UINT64 slot) const {return _slots[slot].pc;}
+  const VALUE &valueAt(const UINT64 slot) const {return _slots[slot].value;}
+private:
+  static const UINT64 EMPTY = ~UINT64(0); // not an instruction address
+  struct Slot {
+    Slot(): pc(EMPTY), value() {}
+    UINT64 pc;
+    VALUE value;
+  };
+  const UINT64 probe(const UINT64 pc) const;
+  void grow();
+  vector<Slot> _slots;
+  UINT64 _size;
+};
+
+/* ===================================================================== */
+
+// The slot holding a PC, or the empty slot where it would go
+template <class VALUE>
+const UINT64 PCTable<VALUE>::probe(const UINT64 pc) const
+{
+  UINT64 mask = _slots.size() - 1;
+  UINT64 slot = hashKey(pc) & mask;
+  while (_slots[slot].pc != pc && _slots[slot].pc != EMPTY) slot = (slot + 1) & mask;
+  return slot;
+}
+
+/* ===================================================================== */
+
+// The counters of a PC, value-initialized on its first use
+template <class VALUE>
+VALUE &PCTable<VALUE>::operator[](const UINT64 pc)
+{
+  UINT64 slot = probe(pc);
+  if (_slots[slot].pc == pc) return _slots[slot].value;
+  if (2 * (_size + 1) > _slots.size()) {
+    grow();
+    slot = probe(pc);
+  }
+  _slots[slot].pc = pc;
+  _size++;
+  return _slots[slot].value;
+}
+
+/* ===================================================================== */
+
+template <class VALUE>
+const VALUE *PCTable<VALUE>::find(const UINT64 pc) const
+{
+  UINT64 slot = probe(pc);
+  return _slots[slot].pc == pc ? &_slots[slot].value : NULL;
+}
+
+/* ===================================================================== */
+
+template <class VALUE>
+void PCTable<VALUE>::grow()
+{
+  vector<Slot> old(2 * _slots.size());
+  old.swap(_slots);
+  for (UINT64 i = 0; i < old.size(); i++) {
+    if (old[i].pc != EMPTY) _slots[probe(old[i].pc)] = old[i];
+  }
+}
+
+#endif
+
+/* ===================================================================== */
+/* eof */
+/* ===================================================================== */
@@ -3,47 +3,33 @@
 
 
 #include <stdlib.h>
+#include <cstddef>
 
-#include "dcache_for_prefetcher.hpp"
+#include "buffer_ring.hpp"
+#include "mem_trace.hpp"
+#include "prefetch_sim.hpp"
 #include "pin_profile.H"
 
-class PrefetcherInterface {
-public:
-  virtual void prefetch(ADDRINT addr, ADDRINT loadPC) = 0;
-  virtual void train(ADDRINT addr, ADDRINT loadPC) = 0;
-};
-
-PrefetcherInterface *prefetcher;
-
-ofstream outFile;
-Cache *cache;
-UINT64 loads;
-UINT64 stores;
-UINT64 hits;
-UINT64 accesses, prefetches;
-string prefetcherName;
-int sets;
-int associativity;
-int blockSize;
-UINT64 checkpoint = 100000000;
-UINT64 endpoint = 2000000000;
-
 /* ===================================================================== */
-/* Commandline Switches */
+/* Commandline Switches of the Pin tool, the model's are in prefetch_sim.hpp */
 /* ===================================================================== */
 
-KNOB<string> KnobPrefetcherName(KNOB_MODE_WRITEONCE, "pintool",
-  "pref_type","none", "prefetcher name");
-KNOB<UINT32> KnobAggression(KNOB_MODE_WRITEONCE, "pintool",
-  "aggr", "2", "the aggression of the prefetcher");
-KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool",
-  "o", "data", "specify output file name");
-KNOB<UINT32> KnobCacheSets(KNOB_MODE_WRITEONCE, "pintool",
-  "sets", "64", "cache size in kilobytes");
-KNOB<UINT32> KnobLineSize(KNOB_MODE_WRITEONCE, "pintool",
-  "b", "4", "cache block size in bytes");
-KNOB<UINT32> KnobAssociativity(KNOB_MODE_WRITEONCE, "pintool",
-  "a", "2", "cache associativity (1 for direct mapped)");
+KNOB<BOOL> KnobBuffered(KNOB_MODE_WRITEONCE, "pintool",
+  "buffered", "0", "record the accesses in a trace buffer and simulate a full buffer at a time instead of every access inline");
+KNOB<UINT32> KnobBufferPages(KNOB_MODE_WRITEONCE, "pintool",
+  "buffer_pages", "256", "4KB pages in each access buffer of -buffered");
+KNOB<BOOL> KnobSimThread(KNOB_MODE_WRITEONCE, "pintool",
+  "sim_thread", "0", "with -buffered, simulate the full buffers on an internal thread while the application runs");
+KNOB<UINT32> KnobSimBuffers(KNOB_MODE_WRITEONCE, "pintool",
+  "sim_buffers", "4", "access buffers each application thread recycles with -sim_thread");
+KNOB<UINT32> KnobShards(KNOB_MODE_WRITEONCE, "pintool",
+  "shards", "1", "with -buffered, split the cache sets over this many threads");
+KNOB<string> KnobRecord(KNOB_MODE_WRITEONCE, "pintool",
+  "record", "", "write the memory accesses to this trace file for cache_replay (implies -buffered)");
+KNOB<BOOL> KnobRecordOnly(KNOB_MODE_WRITEONCE, "pintool",
+  "record_only", "0", "with -record, only record the accesses without simulating them");
+KNOB<BOOL> KnobRecordCompress(KNOB_MODE_WRITEONCE, "pintool",
+  "record_compress", "1", "LZ-compress the chunks of the -record trace");
 
 /* ===================================================================== */
 
@@ -55,400 +41,624 @@ INT32 Usage()
   return -1;
 }
 
-// Take checkpoints with stats in the output file
-void takeCheckPoint()
+/* ===================================================================== */
+
+// Size of the first memory operand of ins that is read, or written if write is set
+const UINT32 memoryOperandSize(INS ins, bool write)
 {
-  outFile << "The checkpoint has been reached" << endl;
-  outFile << "Accesses: " << accesses << " Loads: "<< loads << " Stores: " << stores <<   endl;
-  outFile << "Hits: " << hits << endl;
-  outFile << "Hit rate: " << double(hits) / double(accesses) << endl;
-  outFile << "Prefetches: " << prefetches << endl;
-  outFile << "Successful prefetches: " << cache->getSuccessfulPrefs() << endl;
-  if (accesses ==  endpoint) exit(0);
+  for (UINT32 op = 0; op < INS_MemoryOperandCount(ins); op++) {
+    if (write ? INS_MemoryOperandIsWritten(ins, op) : INS_MemoryOperandIsRead(ins, op)) return INS_MemoryOperandSize(ins, op);
+  }
+  return 0;
 }
 
 /* ===================================================================== */
 
-/* None Prefetcher
-    This does not prefetch anything.
-*/
-class NonePrefetcher : public PrefetcherInterface {
-public:
-  void prefetch(ADDRINT addr, ADDRINT loadPC) {
-    return;
+// Receives all instructions and takes action if the instruction is a load or a store.
+// Narrow accesses call Load()/Store() unless they cross a block at run time, the others LoadMulti()/StoreMulti() with their size
+void Instruction(INS ins, void * v)
+{
+  const UINT32 singleLine = min<UINT32>(SINGLE_LINE_ACCESS_SIZE, blockSize);
+  if (INS_IsMemoryRead(ins) && INS_IsStandardMemop(ins)) {
+    if (memoryOperandSize(ins, false) <= singleLine) {
+      INS_InsertIfPredicatedCall(
+          ins, IPOINT_BEFORE, (AFUNPTR) fitsLine,
+          IARG_MEMORYREAD_EA, IARG_MEMORYREAD_SIZE, IARG_END);
+      INS_InsertThenPredicatedCall(
+          ins, IPOINT_BEFORE, (AFUNPTR) Load,
+          (IARG_MEMORYREAD_EA), IARG_INST_PTR, IARG_END);
+      INS_InsertIfPredicatedCall(
+          ins, IPOINT_BEFORE, (AFUNPTR) crossesLine,
+          IARG_MEMORYREAD_EA, IARG_MEMORYREAD_SIZE, IARG_END);
+      INS_InsertThenPredicatedCall(
+          ins, IPOINT_BEFORE, (AFUNPTR) LoadMulti,
+          (IARG_MEMORYREAD_EA), IARG_MEMORYREAD_SIZE, IARG_INST_PTR, IARG_END);
+    } else {
+      INS_InsertPredicatedCall(
+          ins, IPOINT_BEFORE, (AFUNPTR) LoadMulti,
+          (IARG_MEMORYREAD_EA), IARG_MEMORYREAD_SIZE, IARG_INST_PTR, IARG_END);
+    }
+ }
+  if ( INS_IsMemoryWrite(ins) && INS_IsStandardMemop(ins))
+  {
+    if (memoryOperandSize(ins, true) <= singleLine) {
+      INS_InsertIfPredicatedCall(
+        ins, IPOINT_BEFORE, (AFUNPTR) fitsLine,
+        IARG_MEMORYWRITE_EA, IARG_MEMORYWRITE_SIZE, IARG_END);
+      INS_InsertThenPredicatedCall(
+        ins, IPOINT_BEFORE,  (AFUNPTR) Store,
+        (IARG_MEMORYWRITE_EA), IARG_INST_PTR, IARG_END);
+      INS_InsertIfPredicatedCall(
+        ins, IPOINT_BEFORE, (AFUNPTR) crossesLine,
+        IARG_MEMORYWRITE_EA, IARG_MEMORYWRITE_SIZE, IARG_END);
+      INS_InsertThenPredicatedCall(
+        ins, IPOINT_BEFORE,  (AFUNPTR) StoreMulti,
+        (IARG_MEMORYWRITE_EA), IARG_MEMORYWRITE_SIZE, IARG_INST_PTR, IARG_END);
+    } else {
+      INS_InsertPredicatedCall(
+        ins, IPOINT_BEFORE,  (AFUNPTR) StoreMulti,
+        (IARG_MEMORYWRITE_EA), IARG_MEMORYWRITE_SIZE, IARG_INST_PTR, IARG_END);
+    }
   }
+}
 
-  void train(ADDRINT addr, ADDRINT loadPC) {
-    return;
+/* ===================================================================== */
+
+// With -sample_sets or -tlb the instructions are counted a basic block at a time for the MPKI
+void addInstructions(UINT32 n)
+{
+  instructions += n;
+}
+
+void CountInstructions(TRACE trace, void * v)
+{
+  for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
+    BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR) addInstructions, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
   }
+}
+
+/* ===================================================================== */
+
+// With -buffered the accesses are recorded into a Pin trace buffer and simulated a full buffer at a time
+struct MemAccess {
+  ADDRINT ea;
+  ADDRINT pc;
+  UINT32 isStore;
+  UINT32 size;
 };
 
+BUFFER_ID bufId;
+PIN_LOCK simLock; // the application threads share one cache model
+
+// Record the same accesses as Instruction(): the first read and the first write of every standard memory instruction
+void Trace(TRACE trace, void * v)
+{
+  for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
+    for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins)) {
+      if (!INS_IsStandardMemop(ins)) continue;
+      if (INS_IsMemoryRead(ins)) {
+        INS_InsertFillBufferPredicated(ins, IPOINT_BEFORE, bufId,
+            IARG_MEMORYREAD_EA, offsetof(MemAccess, ea), IARG_INST_PTR, offsetof(MemAccess, pc),
+            IARG_UINT32, 0, offsetof(MemAccess, isStore), IARG_MEMORYREAD_SIZE, offsetof(MemAccess, size), IARG_END);
+      }
+      if (INS_IsMemoryWrite(ins)) {
+        INS_InsertFillBufferPredicated(ins, IPOINT_BEFORE, bufId,
+            IARG_MEMORYWRITE_EA, offsetof(MemAccess, ea), IARG_INST_PTR, offsetof(MemAccess, pc),
+            IARG_UINT32, 1, offsetof(MemAccess, isStore), IARG_MEMORYWRITE_SIZE, offsetof(MemAccess, size), IARG_END);
+      }
+    }
+  }
+}
+
 /* ===================================================================== */
 
-/* Next Line Prefetcher
-    This is an example implementation of the next line Prefetcher.
-    The stride prefetcher would also need the program counter of the load instruction.
+/* Set-sharded simulation (-shards N)
+    The sets of the d-cache are split round-robin over N shards, each with its own Cache of
+    sets / N sets, so a buffer is simulated by N threads at once: the caller runs shard 0 and
+    an internal worker thread runs each of the others. The prefetcher is shared and runs under
+    prefetcherLock; its prefetches are routed to the inbox of the shard owning the block, which
+    fills them before its next access, so a prefetch for another shard may land up to one buffer
+    late. The events for the accounting are logged per shard and replayed, together with the
+    shard counters, once all the shards of a buffer are done.
+    A composite prefetcher spends its issue budget only on the prefetches that fill a block, so
+    then the cache of a shard is also guarded by a lock, under which routeToShard() checks that
+    the block is neither present nor already routed.
 */
-class NextNLinePrefetcher : public PrefetcherInterface {
+struct RoutedPrefetch {
+  UINT64 addr;
+  int prefetcher;
+  UINT64 pc;
+};
+
+struct ShardEvent {
+  enum Kind { PREF_ISSUED, PREF_USED, PREF_UNUSED, DEMAND_EVICTED, POLLUTION_MISS } kind;
+  UINT64 addr;
+  int prefetcher;
+  UINT64 pc;
+};
+
+const UINT32 shardOf(const UINT64 addr) {return (addr / blockSize) % sets % shardCount;}
+
+// The address a block has inside its shard: same tag, set divided by the shard count
+const UINT64 toShardAddr(const UINT64 addr)
+{
+  UINT64 block = addr / blockSize;
+  UINT64 set = block % sets;
+  return ((block / sets) * (sets / shardCount) + set / shardCount) * blockSize + addr % blockSize;
+}
+
+const UINT64 fromShardAddr(const UINT64 shardAddr, const UINT32 shard)
+{
+  UINT64 block = shardAddr / blockSize;
+  UINT64 shardSets = sets / shardCount;
+  return ((block / shardSets) * sets + (block % shardSets) * shardCount + shard) * blockSize;
+}
+
+PIN_LOCK prefetcherLock;
+bool lockShardCaches = false; // with a composite prefetcher, which needs to know if a routed prefetch fills a block
+
+class Shard : public PrefetchEventListener {
 public:
-  void prefetch(ADDRINT addr, ADDRINT loadPC) {
-    for (int i = 1; i <= aggression; i++) {
-      UINT64 nextAddr = addr + i * blockSize;
-      if (!cache->exists(nextAddr)) {  // Use the member function Cache::exists(UINT64) to query whehter a block exists in the cache w/o triggering any LRU changes (not after a demand access)
-          cache->prefetchFillLine(nextAddr); // Use the member function Cache::prefetchFillLine(UINT64) when you fill the cache in the LRU way for prefetch accesses
-          prefetches++;
-      }
+  Shard(const UINT32 index, const bool pollution);
+  void run();
+  void replay(PrefetchAccounting *acc);
+  void route(const RoutedPrefetch &r);
+  const bool wouldFill(const UINT64 addr);
+  void prefetchUsed(const UINT64 addr) {log(ShardEvent::PREF_USED, fromShardAddr(addr, _index));}
+  void prefetchUnused(const UINT64 addr) {log(ShardEvent::PREF_UNUSED, fromShardAddr(addr, _index));}
+  void demandBlockEvicted(const UINT64 addr) {log(ShardEvent::DEMAND_EVICTED, fromShardAddr(addr, _index), _evictor);}
+  Cache cache;
+  Cache *shadow;
+  vector<const MemAccess *> work; // accesses of the current buffer that map to this shard
+  UINT64 hits, shadowMisses, triggers, prefetches;
+private:
+  void access(const MemAccess &a);
+  void drainInbox();
+  void lockCache() {if (lockShardCaches) PIN_GetLock(&_cacheLock, _index + 1);}
+  void unlockCache() {if (lockShardCaches) PIN_ReleaseLock(&_cacheLock);}
+  void log(const ShardEvent::Kind kind, const UINT64 addr, const int prefetcher = 0, const UINT64 pc = 0);
+  UINT32 _index;
+  vector<RoutedPrefetch> _inbox;  // filled by any shard under _inboxLock
+  vector<RoutedPrefetch> _routed; // taken from the inbox by this shard
+  PIN_LOCK _inboxLock;
+  PIN_LOCK _cacheLock; // taken by this shard to change cache and by others to look into it, with lockShardCaches
+  atomic<bool> _inboxPending;
+  vector<ShardEvent> _events;
+  int _evictor; // prefetcher of the block being filled
+};
+
+/* ===================================================================== */
+
+Shard::Shard(const UINT32 index, const bool pollution): cache(sets / shardCount, associativity, blockSize), shadow(NULL),
+                hits(0), shadowMisses(0), triggers(0), prefetches(0), _index(index), _inboxPending(false), _evictor(0)
+{
+  cache.setListener(this);
+  if (pollution) shadow = new Cache(sets / shardCount, associativity, blockSize);
+  PIN_InitLock(&_inboxLock);
+  PIN_InitLock(&_cacheLock);
+}
+
+/* ===================================================================== */
+
+void Shard::log(const ShardEvent::Kind kind, const UINT64 addr, const int prefetcher, const UINT64 pc)
+{
+  ShardEvent e = {kind, addr, prefetcher, pc};
+  _events.push_back(e);
+}
+
+/* ===================================================================== */
+
+// Called by the shard running the prefetcher
+void Shard::route(const RoutedPrefetch &r)
+{
+  PIN_GetLock(&_inboxLock, _index + 1);
+  _inbox.push_back(r);
+  _inboxPending = true;
+  PIN_ReleaseLock(&_inboxLock);
+}
+
+/* ===================================================================== */
+
+// Whether a prefetch routed now would fill a block, i.e. the block is not in the cache or the inbox yet;
+// called by the shard running the prefetcher, never while it holds its own cache lock
+const bool Shard::wouldFill(const UINT64 addr)
+{
+  lockCache();
+  bool present = cache.exists(toShardAddr(addr));
+  unlockCache();
+  if (present) return false;
+  PIN_GetLock(&_inboxLock, _index + 1);
+  bool routed = false;
+  for (uint i = 0; i < _inbox.size() && !routed; i++) routed = _inbox.at(i).addr / blockSize == addr / blockSize;
+  PIN_ReleaseLock(&_inboxLock);
+  return !routed;
+}
+
+/* ===================================================================== */
+
+// Fill the prefetches routed to this shard, as issuePrefetch() does without a prefetch buffer or MSHRs
+void Shard::drainInbox()
+{
+  if (!_inboxPending) return;
+  PIN_GetLock(&_inboxLock, _index + 1);
+  _routed.swap(_inbox);
+  _inboxPending = false;
+  PIN_ReleaseLock(&_inboxLock);
+  for (uint i = 0; i < _routed.size(); i++) {
+    const RoutedPrefetch &r = _routed.at(i);
+    UINT64 shardAddr = toShardAddr(r.addr);
+    if (cache.exists(shardAddr)) continue;
+    log(ShardEvent::PREF_ISSUED, r.addr, r.prefetcher, r.pc);
+    _evictor = r.prefetcher;
+    lockCache();
+    cache.prefetchFillLine(shardAddr);
+    unlockCache();
+    prefetches++;
+  }
+  _routed.clear();
+}
+
+/* ===================================================================== */
+
+// Load() and Store() for one shard
+void Shard::access(const MemAccess &a)
+{
+  UINT64 shardAddr = toShardAddr(a.ea);
+  lockCache();
+  bool hit = cache.probeTag(shardAddr);
+  bool prefetchedHit = hit && cache.hitPrefetched();
+  if (!hit) cache.fillLine(shardAddr);
+  unlockCache();
+  if (hit) hits++;
+  if (shadow) {
+    if (shadow->probeTag(shardAddr)) {
+      if (!hit) log(ShardEvent::POLLUTION_MISS, a.ea);
+    } else {
+      shadowMisses++;
+      shadow->fillLine(shardAddr);
     }
   }
+  if (a.isStore && !trainStores) return;
+  bool isTriggered = isTrigger(hit, prefetchedHit);
+  if (!isTriggered && !observeAccesses) return;
+  PIN_GetLock(&prefetcherLock, _index + 1);
+  if (observeAccesses) prefetcher->observe(a.ea, a.pc);
+  if (isTriggered) {
+    triggers++;
+    accounting->setTriggerPC(a.pc);
+    prefetcher->prefetch(a.ea, a.pc);
+    prefetcher->train(a.ea, a.pc);
+  }
+  PIN_ReleaseLock(&prefetcherLock);
+}
 
-  void train(ADDRINT addr, ADDRINT loadPC) {
-    return;
+/* ===================================================================== */
+
+void Shard::run()
+{
+  for (uint i = 0; i < work.size(); i++) {
+    drainInbox();
+    access(*work.at(i));
   }
-};
+  drainInbox();
+}
 
-class StridePrefetcher : public PrefetcherInterface {
-  private:
-    // Reference Prediction Table
-    UINT64 RPT[64][4] = {0};
-    UINT64 numberOfEntries = 0; // number of entries in the RPT - initially no entry added
-    int entryIdx = -1; // index in RPT for corresponding PC
-    // States -> Initial=0; Transient=1; Steady=2; No prediction=3
-
-
-  public:
-    void prefetch(ADDRINT addr, ADDRINT loadPC) {
-      // the index of RPT
-      entryIdx = -1;
-      for (UINT64 rpt_idx = 0; rpt_idx < numberOfEntries; rpt_idx++) { // loop over the entries of RPT
-        if (RPT[rpt_idx][0] == loadPC) { //if entry present in RPT
-          entryIdx = rpt_idx; // update the entryIdx as we found PC
-          UINT64 pred_addr = RPT[rpt_idx][1] + RPT[rpt_idx][2];
-          // begin prefetching only if the state is stable and prediction is correct
-          // NOTE check if we need RPT[rpt_idx][3] == 2 or RPT[rpt_idx][3] != 3
-          if (pred_addr == addr) { // correct prediction
-            if (RPT[rpt_idx][3] == 2) { // correct state
-              for (int i = 1; i <= aggression; i++) {
-                UINT64 nextAddr = addr + i * RPT[rpt_idx][2];
-                if (!cache->exists(nextAddr)) {  
-                    cache->prefetchFillLine(nextAddr); 
-                    prefetches++;
-                }
-              }              
-            }
-          }
-          break; // found the entry so no need to look further
-        }
-      }
+/* ===================================================================== */
+
+// Apply the logged events to the accounting; only called while no shard is running
+void Shard::replay(PrefetchAccounting *acc)
+{
+  for (uint i = 0; i < _events.size(); i++) {
+    const ShardEvent &e = _events.at(i);
+    switch (e.kind) {
+      case ShardEvent::PREF_ISSUED:
+        acc->setPrefetcher(e.prefetcher);
+        acc->setTriggerPC(e.pc);
+        acc->issued(e.addr);
+        break;
+      case ShardEvent::PREF_USED:
+        acc->prefetchUsed(e.addr);
+        break;
+      case ShardEvent::PREF_UNUSED:
+        acc->prefetchUnused(e.addr);
+        break;
+      case ShardEvent::DEMAND_EVICTED:
+        acc->setEvictor(e.prefetcher);
+        acc->demandBlockEvicted(e.addr);
+        break;
+      case ShardEvent::POLLUTION_MISS:
+        acc->pollutionMiss(e.addr);
+        break;
     }
+  }
+  _events.clear();
+}
 
-    void train(ADDRINT addr, ADDRINT loadPC) {
+/* ===================================================================== */
 
-      if (entryIdx==-1) { // add the entry in RPT as PC not in RPT
-        UINT64 entryToReplace = 0; // which entry to replace
-        if (numberOfEntries >= 64) { // if RPT is full the replace randomly
-          entryToReplace = rand()%64;
-        } else { // else add the entry in RPT
-          entryToReplace = numberOfEntries;
-          numberOfEntries++;
-        }
+vector<Shard *> shards;
+vector<PIN_THREAD_UID> shardThreadUids;
+atomic<UINT64> shardGeneration(0); // bumped to start the workers on a new buffer
+atomic<UINT32> shardsFinished(0);
+atomic<bool> shardExiting(false);
+bool shardWorkersDone = false; // the caller runs every shard itself once the workers have exited
 
-        RPT[entryToReplace][0] = loadPC; //set load PC
-        RPT[entryToReplace][1] = addr; // set the previous addr to current addr
-        RPT[entryToReplace][2] = 0; // set the stride to 0
-        RPT[entryToReplace][3] = 0; // intial state
-      } else {
-        // we found the entry in the RPT - PC present can use the same index from prefetch
-        UINT64 prev_addr = RPT[entryIdx][1]; // previous addr
-        UINT64 pred_addr = prev_addr + RPT[entryIdx][2]; // predicted addr = previous addr + stride
-        if (RPT[entryIdx][3] == 0) { // if in initial state
-          if (addr == pred_addr) { // if prediction correct
-            RPT[entryIdx][3] = 2; // change to steady state
-            RPT[entryIdx][1] = addr; // update the previous address
-          } else { // if prediction incorrect
-            RPT[entryIdx][3] = 1; // change to Transient state
-            RPT[entryIdx][2] = addr - prev_addr; // update the stride
-            RPT[entryIdx][1] = addr; // update the previous address
-          }
-        } else if (RPT[entryIdx][3] == 1) { // if in Transient state
-          if (addr == pred_addr) { // if prediction correct
-            RPT[entryIdx][3] = 2; // change to steady state
-            RPT[entryIdx][1] = addr; // update the previous address
-          } else { // if prediction incorrect
-            RPT[entryIdx][3] = 3; // change to No prediction state
-            RPT[entryIdx][2] = addr - prev_addr; // update the stride
-            RPT[entryIdx][1] = addr; // update the previous address
-          }
-        } else if (RPT[entryIdx][3] == 2) { // if in Steady state
-          if (addr == pred_addr) { // if prediction correct
-            // // This part for updating is sort of confusing and different mediums provide different interpretation
-            RPT[entryIdx][1] = addr + (aggression * RPT[entryIdx][2]); // update the previous address to address of last prefetched block
-          } else { // if prediction incorrect
-            RPT[entryIdx][3] = 0; // change to Initial state
-            RPT[entryIdx][1] = addr; // update the previous address
-          }
-        } else if (RPT[entryIdx][3] == 3) { // if in No prediction state
-          if (addr == pred_addr) { // if prediction correct
-            RPT[entryIdx][3] = 1; // change to Transient state
-            RPT[entryIdx][1] = addr; // update the previous address
-          } else { // if prediction incorrect
-            RPT[entryIdx][2] = addr - prev_addr; // update the stride
-            RPT[entryIdx][1] = addr; // update the previous address
-          }
-        }
-      }
+// Called by issuePrefetch() under prefetcherLock. Without a composite prefetcher nothing uses the result,
+// so the owner is only asked whether the prefetch fills a block with lockShardCaches
+bool routeToShard(UINT64 addr)
+{
+  Shard *owner = shards.at(shardOf(addr));
+  if (lockShardCaches && !owner->wouldFill(addr)) return false;
+  RoutedPrefetch r = {addr, accounting->getPrefetcher(), accounting->getTriggerPC()};
+  owner->route(r);
+  return true;
+}
 
-      
-      
-    }
-};
+long sumShardSuccessfulPrefs()
+{
+  long prefs = 0;
+  for (uint i = 0; i < shards.size(); i++) prefs += shards.at(i)->cache.getSuccessfulPrefs();
+  return prefs;
+}
 
+/* ===================================================================== */
 
-// NOTE: For some reason the microbenchmark2 results are fluctuating a lot, this doens't happen with other benchmarks
-class DistancePrefetcher : public PrefetcherInterface {
-  private:
-    UINT64 prev_addr = 0; // previous miss address
-    INT64 prev_dist = 0; // previous distance
-    INT64** RPT = new INT64*[64]; // Reference Prediction Table
-    INT64 numberOfEntries = 0; // number of entries in RPT
-    bool entryFound; // for every prefetch if the entry is found in RPT
-
-  public:
-    void prefetch(ADDRINT addr, ADDRINT loadPC) {
-
-      INT64 new_dist = addr - prev_addr; // get the new distance
-      entryFound = FALSE; // initially set to false for every prefetch
-
-      for (INT64 k = 0; k < numberOfEntries; k++) { // loop over RPT
-        if (RPT[k][0] == new_dist) { // check if the entry found
-          entryFound = TRUE; // in train no need to add the entry
-          for (int i = 1; i <= aggression; i++) { // prefetch
-            if (RPT[k][i] != 0) { // don't need but helps
-              UINT64 nextAddr = addr + RPT[k][i]; // get all the predicted addresses
-              if (!cache->exists(nextAddr)) {  
-                  cache->prefetchFillLine(nextAddr); 
-                  prefetches++;
-              }
-            } 
-          }
-        }
-      }
+void ShardWorker(void *arg)
+{
+  Shard *shard = static_cast<Shard *>(arg);
+  UINT64 generation = 0;
+  for (;;) {
+    while (shardGeneration == generation) {
+      if (shardExiting) PIN_ExitThread(0);
+      PIN_Yield();
+    }
+    generation = shardGeneration;
+    shard->run();
+    shardsFinished++;
+  }
+}
+
+/* ===================================================================== */
 
+// Simulate the accesses of one buffer on all the shards, then merge their stats
+void simulateSharded(const MemAccess *buf, UINT64 numElements)
+{
+  UINT64 done = 0;
+  while (done < numElements) {
+    UINT64 n = min(numElements - done, checkpoint - accesses % checkpoint); // stop at the next checkpoint
+    for (uint s = 0; s < shards.size(); s++) shards.at(s)->work.clear();
+    for (UINT64 i = done; i < done + n; i++) {
+      shards.at(shardOf(buf[i].ea))->work.push_back(&buf[i]);
+      if (buf[i].isStore) stores++;
+      else loads++;
+    }
+    accesses += n;
+    done += n;
+    if (shardWorkersDone) {
+      for (uint s = 0; s < shards.size(); s++) shards.at(s)->run();
+    } else {
+      shardsFinished = 0;
+      shardGeneration++;
+      shards.at(0)->run();
+      while (shardsFinished < shards.size() - 1) PIN_Yield();
+    }
+    for (uint s = 0; s < shards.size(); s++) {
+      Shard *shard = shards.at(s);
+      hits += shard->hits;
+      shadowMisses += shard->shadowMisses;
+      triggers += shard->triggers;
+      prefetches += shard->prefetches;
+      shard->hits = shard->shadowMisses = shard->triggers = shard->prefetches = 0;
+      shard->replay(accounting);
     }
+    if (accesses % checkpoint == 0) takeCheckPoint();
+  }
+}
 
-    void train(ADDRINT addr, ADDRINT loadPC) {
-      INT64 new_dist = addr - prev_addr; // get the new distance
+/* ===================================================================== */
 
-      if (entryFound==FALSE) { // add the entry in RPT corresponding to new dist as it is not present
-        INT64 entryToReplace = 0; // which entry to replace
-        if (numberOfEntries >= 64) { // if RPT is full the replace randomly
-          entryToReplace = rand()%64;
-        } else { // else add the entry in RPT
-          entryToReplace = numberOfEntries;
-          numberOfEntries++;
-        }
-        RPT[entryToReplace] = new INT64[aggression+1]; // initialize the predicted distances
-        for (int i=1 ; i <= aggression ; i++) {
-            RPT[entryToReplace][i] = 0;
-          }
-        RPT[entryToReplace][0] = new_dist; // set distance tag
-      }
+// The shards simulate one block per access: split the accesses of a buffer that span several
+// blocks, as LoadMulti() and StoreMulti() do, into lineAccesses. Returns buf itself if none does
+vector<MemAccess> lineAccesses;
 
-      // newly observed distance must be added as a predicted distance to the RPT entry that refers to the previous distance
-      for (INT64 k = 0; k < numberOfEntries; k++) {
-        if (RPT[k][0] == prev_dist) { // check if the prev distance entry is present in RPT
-          bool pdFull = TRUE; // flag to check if any of the predicted distance is empty
-          for (int i=1 ; i <= aggression ; i++) {
-            if (RPT[k][i] == 0) {
-              RPT[k][i] = new_dist;
-              pdFull = FALSE;
-              break;
-            }
-          }
+const MemAccess *splitLines(const MemAccess *buf, UINT64 &numElements)
+{
+  UINT64 i = 0;
+  while (i < numElements && buf[i].ea % blockSize + buf[i].size <= UINT64(blockSize)) i++;
+  if (i == numElements) return buf;
+  lineAccesses.assign(buf, buf + i);
+  for (; i < numElements; i++) {
+    MemAccess a = buf[i];
+    UINT64 last = (a.ea + a.size - 1) / blockSize;
+    lineAccesses.push_back(a);
+    if (a.size == 0 || a.ea / blockSize == last) continue;
+    splitAccesses++;
+    for (UINT64 block = a.ea / blockSize + 1; block <= last; block++) {
+      a.ea = block * blockSize;
+      lineAccesses.push_back(a);
+    }
+  }
+  numElements = lineAccesses.size();
+  return &lineAccesses[0];
+}
 
-          if (pdFull == TRUE) { // if predicted distance not empty then replace randomly
-            int indexToReplace = rand() % aggression + 1; 
-            RPT[k][indexToReplace] = new_dist;
-          }
-        }
-      }
+/* ===================================================================== */
 
-      prev_addr = addr;
-      prev_dist = new_dist;
+// Simulate a buffer of accesses in program order
+void simulateBuffer(const MemAccess *buf, UINT64 numElements)
+{
+  if (shardCount) {
+    const MemAccess *lines = splitLines(buf, numElements);
+    simulateSharded(lines, numElements);
+    return;
+  }
+  for (UINT64 i = 0; i < numElements; i++) {
+    if (buf[i].isStore) StoreMulti(buf[i].ea, buf[i].size, buf[i].pc);
+    else LoadMulti(buf[i].ea, buf[i].size, buf[i].pc);
+  }
+}
 
-    }
+/* ===================================================================== */
+
+// With -sim_thread the full buffers are simulated by an internal thread while the application keeps running.
+// Every application thread recycles its own -sim_buffers buffers, as in MemTrace/membuffer_threadpool.cpp
+struct AppThreadBuffers {
+  AppThreadBuffers(const UINT32 buffers): freeBuffers(buffers), allocated(1), current(NULL), inFlight(0) {}
+  SPSCRing<void *> freeBuffers; // returned by the simulator thread, taken by the owner
+  UINT32 allocated;             // including the one Pin allocates for the thread
+  void *current;                // the buffer last handed back to Pin
+  atomic<UINT32> inFlight;      // buffers handed to the simulator thread and not yet returned
 };
 
-// #include <map>
-//  ///  Using map
-// class DistancePrefetcher : public PrefetcherInterface {
-//   private:
-//     UINT64 prev_addr = 0; // previous miss address
-//     INT64 prev_dist = 0; // previous distance
-//     map<INT64, INT64*> RPT; // Reference Prediction Table
-//     INT64 all_distances[64] = {0}; // number of entries in RPT
-//     bool entryFound; // for every prefetch if the entry is found in RPT
-//     INT64 new_dist = 0;
-    
-//   public:
-//     void prefetch(ADDRINT addr, ADDRINT loadPC) {
-
-//       new_dist = addr - prev_addr; // get the new distance
-//       entryFound = FALSE; // initially set to false for every prefetch
-//       auto search = RPT.find(new_dist);
-//       if (search != RPT.end()) {
-//         entryFound = TRUE;
-//         for (int i = 0; i < aggression; i++) { // prefetch
-//             UINT64 nextAddr = addr + RPT[new_dist][i]; // get all the predicted addresses
-//             if (!cache->exists(nextAddr)) {  
-//                 cache->prefetchFillLine(nextAddr); 
-//                 prefetches++;
-//             }
-//             cout << "prefetch here: " << nextAddr << endl;
-//           }
-          
-//       }
-//       cout << "checking-> new_dist = " << new_dist << ", prev_dist = " << prev_dist << endl;
-//     }
-
-//     void train(ADDRINT addr, ADDRINT loadPC) {
-//       // INT64 new_dist = addr - prev_addr; // get the new distance
-      
-//       // newly observed distance must be added as a predicted distance to the RPT entry that refers to the previous distance
-//       // auto search = RPT.find(prev_dist);
-//       if (RPT.empty() == FALSE) {
-//         cout << "Append Before: " << prev_dist << ": "<< RPT[prev_dist][0] << " , "<< RPT[prev_dist][1] << " , "<< RPT[prev_dist][2] << endl;
-//         bool pdFull = TRUE; // flag to check if any of the predicted distance is empty
-//         for (int i=0 ; i < aggression ; i++) {
-//           if (RPT[prev_dist][i] == 0) {
-//             RPT[prev_dist][i] = new_dist;
-//             pdFull = FALSE;
-//             break;
-//           }
-//         }
-//         if (pdFull == TRUE) { // if predicted distance not empty then replace randomly
-//           int indexToReplace = rand() % aggression; 
-//           cout << "indexToReplace: " << indexToReplace << endl;
-//           RPT[prev_dist][indexToReplace] = new_dist;
-//         }
-//         cout << "Append After: " << prev_dist << ": "<< RPT[prev_dist][0] << " , "<< RPT[prev_dist][1] << " , "<< RPT[prev_dist][2] << endl;
-//       }
-
-
-//       if (entryFound==FALSE) { // add the entry in RPT corresponding to new dist as it is not present
-//         INT64 entryToReplace = RPT.size();
-//         if (entryToReplace >= 64) { // if RPT is full the replace randomly
-//           entryToReplace = rand()%64;
-//           RPT.erase(all_distances[entryToReplace]);
-//         } 
-//         RPT[new_dist] = new INT64[aggression]; // initialize the predicted distances
-//         for (int i=0 ; i < aggression ; i++) {
-//           RPT[new_dist][i] = 0;
-//         }
-//         all_distances[entryToReplace] = new_dist;
-//         cout << "Entry: " << new_dist << ": "<< RPT[new_dist][0] << " , "<< RPT[new_dist][1] << " , "<< RPT[new_dist][2] << endl;
-//       }
-
-      
-//       // cout << "t->" << prev_dist << ": "<< RPT[prev_dist][0] << " , "<< RPT[prev_dist][1] << " , "<< RPT[prev_dist][2] << endl;
-
-//       // cout << "prev_addr:" << prev_addr << ", prev_dist: " << prev_dist << endl;
-//       prev_addr = addr;
-//       prev_dist = new_dist;
-
-//     }
-// };
-
-
-//---------------------------------------------------------------------
-//##############################################
-/*
- * Your changes here.
- *
- * Put your prefetcher implementation here
- *
- * Example:
- *
- * class StridePrefetcher : public PrefetcherInterface {
- * private:
- *  // set up private members
- *
- * public:
- *  void prefetch(ADDRINT addr, ADDRINT loadPC) {
- *      // Prefetcher implementation
- *  }
- *
- *  void train(ADDRINT addr, ADDRINT loadPC) {
- *      // Training implementation
- *  }
- * };
- *
- * You can modify the functions Load() and Store() where necessary to implement your functionality
- *
- * DIRECTIONS ON USING THE COMMAND LINE ARGUMENT
- *    The string variable "prefetcherName" indicates the name of the prefetcher that is passed as a command line argument (-pref_type)
- *    The integer variable "aggression" indicates the aggressiveness indicated by the command line argument (-aggr)
- *
- * STATS:
- * ***Note that these exist to help you debug your program and produce your graphs
- *  The member function Cache::getSuccessfulPrefs() returns how many of the prefetched block into the cache were actually used. This applies in  the case where no prefetch buffer is used.
- *  The integer variable "prefetches" should count the number of prefetched blocks
- *  The integer variable "accesses" counts the number of memory accesses performed by the program
- *  The integer variable "hits" counts the number of memory accesses that actually hit in either the data cache or the prefetch buffer such that hits = cacheHits + prefHits
- *
- */
-//##############################################
-//---------------------------------------------------------------------
-
-
-/* ===================================================================== */
-
-/* Action taken on a load. Load takes 2 arguments:
-    addr: the address of the demanded block (in bytes)
-    pc: the program counter of the load instruction
-*/
-void Load(ADDRINT addr, ADDRINT pc)
+struct FullBuffer {
+  void *buf;
+  UINT64 numElements;
+  AppThreadBuffers *owner;
+};
+
+SPSCRing<FullBuffer> *fullBuffers = NULL; // application threads -> simulator thread
+PIN_LOCK producerLock; // makes the application threads a single producer of fullBuffers
+TLS_KEY appThreadKey;
+UINT32 buffersPerThread;
+PIN_THREAD_UID simThreadUid;
+atomic<bool> simThreadStarted(false), simThreadExiting(false);
+bool simThreadDone = false; // set under producerLock once the last queued buffer was simulated
+UINT64 buffersOnSimThread = 0, buffersInline = 0;
+
+/* ===================================================================== */
+
+// Queue a full buffer for the simulator thread and return the next one to fill, or NULL if
+// the thread is not running; the application thread must not wait for it to start
+void *queueBuffer(THREADID tid, void *buf, UINT64 numElements)
 {
-  accesses++;
-  loads++;
-  if (cache->probeTag(addr)) { // Use the function Cache::probeTag(UINT64) when you are probing the cache after a demand access
-    hits++;
+  AppThreadBuffers *own = static_cast<AppThreadBuffers *>(PIN_GetThreadData(appThreadKey, tid));
+  PIN_GetLock(&producerLock, tid + 1);
+  bool queued = simThreadStarted && !simThreadDone;
+  if (queued) {
+    FullBuffer full = {buf, numElements, own};
+    own->inFlight++;
+    while (!fullBuffers->push(full)) PIN_Yield();
+  }
+  PIN_ReleaseLock(&producerLock);
+  if (!queued) {
+    own->current = buf; // simulated inline and reused
+    return NULL;
   }
-  else {
-    cache->fillLine(addr); // Use the member function Cache::fillLine(addr) when you fill in the MRU way for demand accesses
-    prefetcher->prefetch(addr, pc);
-    prefetcher->train(addr, pc);
+  if (own->allocated < buffersPerThread) {
+    own->allocated++;
+    return own->current = PIN_AllocateBuffer(bufId);
   }
-  if (accesses % checkpoint == 0)  takeCheckPoint();
+  while (!own->freeBuffers.pop(own->current)) PIN_Yield(); // every buffer is waiting to be simulated
+  return own->current;
 }
 
 /* ===================================================================== */
 
-//Action taken on a store
-void Store(ADDRINT addr, ADDRINT pc)
+// With -record the buffers are also appended to a trace for cache_replay
+TraceWriter *traceWriter = NULL;
+PIN_LOCK recordLock;
+bool recordOnly = false;
+
+void recordBuffer(const MemAccess *buf, UINT64 numElements)
 {
-  accesses++;
-  stores++;
-  if (cache->probeTag(addr))  hits++;
-  else cache->fillLine(addr);
-  if (accesses % checkpoint == 0) takeCheckPoint();
+  for (UINT64 i = 0; i < numElements; i++) traceWriter->add(buf[i].ea, buf[i].pc, buf[i].size, buf[i].isStore);
 }
 
 /* ===================================================================== */
 
-// Receives all instructions and takes action if the instruction is a load or a store
-// DO NOT MODIFY THIS FUNCTION
-void Instruction(INS ins, void * v)
+// Called by Pin when a thread's buffer is full or the thread exits
+void *BufferFull(BUFFER_ID id, THREADID tid, const CONTEXT *ctxt, void *buf, UINT64 numElements, void *v)
 {
-  if (INS_IsMemoryRead(ins) && INS_IsStandardMemop(ins)) {
-    INS_InsertPredicatedCall(
-        ins, IPOINT_BEFORE, (AFUNPTR) Load,
-        (IARG_MEMORYREAD_EA), IARG_INST_PTR, IARG_END);
- }
-  if ( INS_IsMemoryWrite(ins) && INS_IsStandardMemop(ins))
-  {
-    INS_InsertPredicatedCall(
-      ins, IPOINT_BEFORE,  (AFUNPTR) Store,
-      (IARG_MEMORYWRITE_EA), IARG_INST_PTR, IARG_END);
+  if (traceWriter) {
+    PIN_GetLock(&recordLock, tid + 1);
+    recordBuffer(static_cast<MemAccess *>(buf), numElements);
+    PIN_ReleaseLock(&recordLock);
+    if (recordOnly) return buf;
+  }
+  if (fullBuffers) {
+    void *next = queueBuffer(tid, buf, numElements);
+    if (next) return next;
+  }
+  PIN_GetLock(&simLock, tid + 1);
+  simulateBuffer(static_cast<MemAccess *>(buf), numElements);
+  buffersInline++;
+  PIN_ReleaseLock(&simLock);
+  return buf; // the buffer is reused as is
+}
+
+/* ===================================================================== */
+
+// The internal simulator thread; it exits once the application is finishing and no buffer is left
+void SimulatorThread(void *arg)
+{
+  THREADID tid = PIN_ThreadId();
+  simThreadStarted = true;
+  for (;;) {
+    FullBuffer full;
+    if (fullBuffers->pop(full)) {
+      PIN_GetLock(&simLock, tid + 1);
+      simulateBuffer(static_cast<MemAccess *>(full.buf), full.numElements);
+      buffersOnSimThread++;
+      PIN_ReleaseLock(&simLock);
+      full.owner->freeBuffers.push(full.buf); // never full, the ring holds all the buffers of its thread
+      full.owner->inFlight--;
+    } else if (simThreadExiting) {
+      PIN_GetLock(&producerLock, tid + 1);
+      simThreadDone = fullBuffers->empty();
+      PIN_ReleaseLock(&producerLock);
+      if (simThreadDone) PIN_ExitThread(0);
+    } else {
+      PIN_Yield();
+    }
+  }
+}
+
+/* ===================================================================== */
+
+void ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, void *v)
+{
+  PIN_SetThreadData(appThreadKey, new AppThreadBuffers(buffersPerThread), tid);
+}
+
+/* ===================================================================== */
+
+// Wait until the simulator thread has returned all the buffers of the thread, then free them;
+// Pin has called BufferFull() for the last time, so none of them is filled any more
+void ThreadFini(THREADID tid, const CONTEXT *ctxt, INT32 code, void *v)
+{
+  AppThreadBuffers *own = static_cast<AppThreadBuffers *>(PIN_GetThreadData(appThreadKey, tid));
+  while (own->inFlight > 0) PIN_Yield();
+  if (own->allocated > 1) { // otherwise the only buffer is still the one Pin allocated and frees
+    void *buf;
+    while (own->freeBuffers.pop(buf)) PIN_DeallocateBuffer(bufId, buf);
+    PIN_DeallocateBuffer(bufId, own->current);
+  }
+  delete own;
+  PIN_SetThreadData(appThreadKey, NULL, tid);
+}
+
+/* ===================================================================== */
+
+// Let the simulator thread finish the queued buffers before Fini() prints the stats, then stop the shard workers
+void PrepareForFini(void *v)
+{
+  INT32 exitCode;
+  if (fullBuffers) {
+    simThreadExiting = true;
+    if (!PIN_WaitForThreadTermination(simThreadUid, PIN_INFINITE_TIMEOUT, &exitCode)) {
+      std::cerr << "Error: Could not wait for the simulator thread." << std::endl;
+    }
+  }
+  if (!shardThreadUids.empty()) {
+    PIN_GetLock(&simLock, PIN_ThreadId() + 1); // no buffer is being simulated
+    shardExiting = true;
+    for (uint i = 0; i < shardThreadUids.size(); i++) {
+      if (!PIN_WaitForThreadTermination(shardThreadUids.at(i), PIN_INFINITE_TIMEOUT, &exitCode)) {
+        std::cerr << "Error: Could not wait for a shard worker thread." << std::endl;
+      }
+    }
+    shardWorkersDone = true;
+    PIN_ReleaseLock(&simLock);
   }
 }
 
@@ -457,12 +667,27 @@ void Instruction(INS ins, void * v)
 // Gets called when the program finishes execution
 void Fini(int code, VOID * v)
 {
-    outFile << "The program has completed execution" << endl;
-    takeCheckPoint();
+    reportSimulation();
+    if (fullBuffers) outFile << "Buffers simulated on the simulator thread: " << buffersOnSimThread << " inline: " << buffersInline << endl;
+    if (traceWriter) {
+        traceWriter->close();
+        outFile << "Recorded accesses: " << traceWriter->getAccesses() << " in " << traceWriter->getBytes() << " bytes" << endl;
+    }
     cout << double(hits) / double(accesses) << endl;
     outFile.close();
 }
 
+/* ===================================================================== */
+
+// The routine of a PC for the delinquent load report, from the symbols PIN_InitSymbols() read
+string routineName(UINT64 pc)
+{
+    PIN_LockClient();
+    string name = RTN_FindNameByAddress(pc);
+    PIN_UnlockClient();
+    return name.empty() ? "?" : name;
+}
+
 /* ===================================================================== */
 /* Main                                                                  */
 /* ===================================================================== */
@@ -475,38 +700,81 @@ int main(int argc, char *argv[])
         return Usage();
     }
 
-    // Initialize stats
-    hits = 0;
-    accesses = 0;
-    prefetches = 0;
-    loads = 0;
-    stores = 0;
-    aggression = KnobAggression.Value();
-    sets = KnobCacheSets.Value();
-    associativity = KnobAssociativity.Value();
-    blockSize =  KnobLineSize.Value();
-    prefetcherName = KnobPrefetcherName;
-
-    if (prefetcherName == "none") {
-        prefetcher = new NonePrefetcher();
-    } else if (prefetcherName == "next_n_lines") {
-        prefetcher = new NextNLinePrefetcher();
-    } else if (prefetcherName == "stride") {
-        // Uncomment when you implement the stride prefetcher
-        prefetcher = new StridePrefetcher();
-    } else if (prefetcherName == "distance") {
-        // Uncomment when you implement the distance prefetcher
-        prefetcher = new DistancePrefetcher();
-    } else {
-        std::cerr << "Error: No such type of prefetcher. Simulation will be terminated." << std::endl;
-        std::exit(EXIT_FAILURE);
+    bool buffered = KnobBuffered.Value() || !KnobRecord.Value().empty();
+    if (KnobShards.Value() > 1) {
+        if (KnobCacheSets.Value() % KnobShards.Value() != 0 || !buffered) {
+            std::cerr << "Error: -shards needs -buffered and must divide the number of sets. Simulation will be terminated." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        if (KnobPrefetchBuffer.Value() != "none" || KnobMemLatency.Value() > 0 || KnobAdaptive.Value() || KnobSampleSets.Value() > 0 ||
+            KnobPageMap.Value() != "none" || KnobTLB.Value()) {
+            std::cerr << "Error: -shards does not support -pref_buffer, -mem_latency, -adaptive, -sample_sets, -page_map or -tlb. Simulation will be terminated." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        shardCount = KnobShards.Value();
+    }
+
+    pcName = routineName;
+    setupSimulation();
+    if (sampler || tlb) TRACE_AddInstrumentFunction(CountInstructions, 0);
+
+    if (shardCount) {
+        lockShardCaches = composite != NULL;
+        for (UINT32 i = 0; i < shardCount; i++) shards.push_back(new Shard(i, KnobPollution.Value()));
+        PIN_InitLock(&prefetcherLock);
+        routePrefetch = routeToShard;
+        shardSuccessfulPrefs = sumShardSuccessfulPrefs;
     }
 
-    // create a data cache
-    cache = new Cache(sets, associativity, blockSize);
+    if (!KnobRecord.Value().empty()) {
+        traceWriter = new TraceWriter(KnobRecord.Value(), KnobRecordCompress.Value());
+        if (!traceWriter->good()) {
+            std::cerr << "Error: Could not open the trace file " << KnobRecord.Value() << ". Simulation will be terminated." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        PIN_InitLock(&recordLock);
+        recordOnly = KnobRecordOnly.Value();
+    }
 
-    outFile.open(KnobOutputFile.Value());
-    INS_AddInstrumentFunction(Instruction, 0);
+    if (buffered) {
+        bufId = PIN_DefineTraceBuffer(sizeof(MemAccess), KnobBufferPages.Value(), BufferFull, 0);
+        if (bufId == BUFFER_ID_INVALID) {
+            std::cerr << "Error: Could not allocate the access buffer. Simulation will be terminated." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        PIN_InitLock(&simLock);
+        TRACE_AddInstrumentFunction(Trace, 0);
+        if (KnobSimThread.Value()) {
+            if (KnobSimBuffers.Value() < 2) {
+                std::cerr << "Error: -sim_thread needs at least two buffers per thread. Simulation will be terminated." << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+            buffersPerThread = KnobSimBuffers.Value();
+            fullBuffers = new SPSCRing<FullBuffer>(4 * buffersPerThread);
+            PIN_InitLock(&producerLock);
+            appThreadKey = PIN_CreateThreadDataKey(0);
+            PIN_AddThreadStartFunction(ThreadStart, 0);
+            PIN_AddThreadFiniFunction(ThreadFini, 0);
+            if (PIN_SpawnInternalThread(SimulatorThread, NULL, 0, &simThreadUid) == INVALID_THREADID) {
+                std::cerr << "Error: Could not start the simulator thread. Simulation will be terminated." << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+        }
+        for (UINT32 i = 1; i < shardCount; i++) {
+            PIN_THREAD_UID uid;
+            if (PIN_SpawnInternalThread(ShardWorker, shards.at(i), 0, &uid) == INVALID_THREADID) {
+                std::cerr << "Error: Could not start a shard worker thread. Simulation will be terminated." << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+            shardThreadUids.push_back(uid);
+        }
+        if (fullBuffers || !shardThreadUids.empty()) PIN_AddPrepareForFiniFunction(PrepareForFini, 0);
+    } else if (KnobSimThread.Value()) {
+        std::cerr << "Error: -sim_thread needs -buffered. Simulation will be terminated." << std::endl;
+        std::exit(EXIT_FAILURE);
+    } else {
+        INS_AddInstrumentFunction(Instruction, 0);
+    }
     PIN_AddFiniFunction(Fini, 0);
 
     // Never returns
@@ -0,0 +1,101 @@
+
+/*
+ * Writes the synthetic memory traces of the cache_replay tests in makefile.rules, e.g.
+ *   obj-intel64/replay_trace_gen.exe regions regions.trace
+ * The patterns:
+ *   regions: 5 fixed blocks of every 2KB region, regions visited once each in order, all by the
+ *            same loads, so only a spatial footprint prefetcher can cover them
+ *   streams: 4 interleaved sequential streams of 8-byte loads, in different sets of the default d-cache
+ *   sweeps:  the same 64 blocks read in descending order again and again; they fit a 4KB d-cache, so the
+ *            blocks prefetched below them only pollute it
+ *   bursts:  runs of 2 blocks, each in a new page, between reads of a 96-block working set that fits
+ *            an 8KB d-cache, so prefetching far past a run only evicts the working set
+ * The chunks are LZ compressed unless the last argument is raw; corrupt and empty write a compressed
+ * trace whose first chunk is then damaged, for the tests of the trace reader.
+ */
+
+#include "pin_shim.hpp"
+#include "mem_trace.hpp"
+
+/* ===================================================================== */
+
+void regions(TraceWriter &trace)
+{
+  static const UINT64 offsets[] = {0, 3, 9, 17, 28}; // blocks of 64B in the region
+  for (UINT64 region = 0; region < 100000; region++) {
+    for (int i = 0; i < 5; i++) trace.add(0x10000000 + region * 2048 + offsets[i] * 64, 0x400100 + i * 8, 8, false);
+  }
+}
+
+/* ===================================================================== */
+
+void streams(TraceWriter &trace)
+{
+  for (UINT64 i = 0; i < 200000; i++) {
+    for (int s = 0; s < 4; s++) trace.add(0x10000000 + s * 0x4000400 + i * 8, 0x400200 + s * 8, 8, false); // 16 sets apart
+  }
+}
+
+void sweeps(TraceWriter &trace)
+{
+  for (UINT64 sweep = 0; sweep < 2000; sweep++) {
+    for (UINT64 i = 0; i < 64; i++) trace.add(0x10000000 + (63 - i) * 64, 0x400300, 8, false);
+  }
+}
+
+void bursts(TraceWriter &trace)
+{
+  UINT64 ws = 0;
+  for (UINT64 run = 0; run < 100000; run++) {
+    for (int i = 0; i < 2; i++) trace.add(0x40000000 + run * 4096 + i * 64, 0x400400, 8, false);
+    for (int i = 0; i < 8; i++, ws++) trace.add(0x10000000 + (ws % 96) * 64, 0x400408, 8, false);
+  }
+}
+
+/* ===================================================================== */
+
+// Damage the first chunk of a closed trace for the corrupt input tests: overwrite the start of its
+// payload, or claim it stores no bytes
+void damage(const char *path, const string &how)
+{
+  fstream file(path, ios::in | ios::out | ios::binary);
+  static const UINT8 garbage[4] = {0xff, 0xff, 0xff, 0xff};
+  static const UINT32 noBytes = 0;
+  file.seekp(sizeof(TRACE_MAGIC) + (how == "corrupt" ? 4 * sizeof(UINT32) : 2 * sizeof(UINT32)));
+  if (how == "corrupt") file.write(reinterpret_cast<const char *>(garbage), sizeof(garbage));
+  else file.write(reinterpret_cast<const char *>(&noBytes), sizeof(noBytes));
+}
+
+/* ===================================================================== */
+/* Main                                                                  */
+/* ===================================================================== */
+
+int main(int argc, char *argv[])
+{
+    string how = argc == 4 ? argv[3] : "lz";
+    if ((argc != 3 && argc != 4) || (how != "lz" && how != "raw" && how != "corrupt" && how != "empty")) {
+        cerr << "usage: replay_trace_gen regions|streams|sweeps|bursts <trace> [lz|raw|corrupt|empty]" << endl;
+        return -1;
+    }
+    TraceWriter trace(argv[2], how != "raw");
+    if (!trace.good()) {
+        std::cerr << "Error: Could not open the trace file " << argv[2] << "." << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    string pattern = argv[1];
+    if (pattern == "regions") regions(trace);
+    else if (pattern == "streams") streams(trace);
+    else if (pattern == "sweeps") sweeps(trace);
+    else if (pattern == "bursts") bursts(trace);
+    else {
+        std::cerr << "Error: No such trace pattern." << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    trace.close();
+    if (how == "corrupt" || how == "empty") damage(argv[2], how);
+    return 0;
+}
+
+/* ===================================================================== */
+/* eof */
+/* ===================================================================== */
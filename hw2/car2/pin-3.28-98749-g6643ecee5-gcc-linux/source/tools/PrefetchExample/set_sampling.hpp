@@ -0,0 +1,144 @@
+#ifndef SET_SAMPLING_H
+#define SET_SAMPLING_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "dcache_for_prefetcher.hpp"
+#include "prefetch_tables.hpp"
+
+using namespace std;
+
+/* Set sampling (-sample_sets N)
+    Only N of the sets of the d-cache are simulated, every sets / N-th set or the N sets with the
+    smallest hash; the accesses and prefetches to the other sets are dropped before they reach the
+    cache or the prefetcher. Each sampled set is a sample unit, so the totals are extrapolated as
+    sets times the mean of a sampled set, and the hit rate and prefetch accuracy as ratio
+    estimators, with 95% confidence intervals from the spread between the sampled sets and the
+    finite population correction. The prefetcher only trains on the sampled sets, so a prefetcher
+    that follows streams across sets sees them with gaps.
+*/
+class SetSampler {
+public:
+  SetSampler(const int sets, const int blockSize, const int sampledSets, const bool hashed);
+  const int sampleOf(const UINT64 addr) const {return _sampleOf[_pow2 ? _indexing.set<true>(addr) : _indexing.set<false>(addr)];} // -1 if not sampled
+  void access(const int sample, const bool hit, const bool prefetchedHit);
+  void prefetchIssued(const int sample) {_samples[sample].prefetches++;}
+  void filtered() {_filtered++;}
+  void print(ostream &out, const UINT64 instructions) const;
+private:
+  struct Counters {
+    Counters(): accesses(0), misses(0), prefetches(0), usedPrefetches(0) {}
+    UINT64 accesses;
+    UINT64 misses;
+    UINT64 prefetches;
+    UINT64 usedPrefetches; // first demand hits on prefetched blocks
+  };
+  const double total(UINT64 Counters::*field, double &halfWidth) const;
+  const double ratio(UINT64 Counters::*num, UINT64 Counters::*den, double &halfWidth) const;
+  SetIndexing _indexing;
+  bool _pow2;
+  vector<int> _sampleOf; // per set
+  vector<Counters> _samples;
+  UINT64 _sets;
+  bool _hashed;
+  UINT64 _filtered; // accesses to the sets that are not sampled
+};
+
+/* ===================================================================== */
+
+SetSampler::SetSampler(const int sets, const int blockSize, const int sampledSets, const bool hashed): _indexing(sets, blockSize),
+                _pow2(_indexing.pow2()), _sampleOf(sets, -1), _samples(sampledSets), _sets(sets), _hashed(hashed), _filtered(0)
+{
+  // the sets with the smallest key are sampled; one round of hashKey() leaves the order of small
+  // neighbouring numbers almost linear, so the hash takes the second round of the 64-bit MurmurHash3 finalizer
+  vector<pair<UINT64, int> > order; // key, set
+  UINT64 stride = sets / sampledSets;
+  for (int set = 0; set < sets; set++) {
+    order.push_back(make_pair(hashed ? hashKey(hashKey(set + 1) * 0xc4ceb9fe1a85ec53ULL) : (set % stride == 0 ? set / stride : sets), set));
+  }
+  sort(order.begin(), order.end());
+  for (int i = 0; i < sampledSets; i++) _sampleOf.at(order.at(i).second) = i;
+}
+
+/* ===================================================================== */
+
+void SetSampler::access(const int sample, const bool hit, const bool prefetchedHit)
+{
+  Counters &c = _samples[sample];
+  c.accesses++;
+  if (!hit) c.misses++;
+  if (prefetchedHit) c.usedPrefetches++;
+}
+
+/* ===================================================================== */
+
+// Extrapolate the sum of a counter over all the sets; halfWidth is the half width of its 95% confidence interval
+const double SetSampler::total(UINT64 Counters::*field, double &halfWidth) const
+{
+  double n = _samples.size(), sum = 0, sumSquares = 0;
+  for (uint i = 0; i < _samples.size(); i++) {
+    double x = _samples[i].*field;
+    sum += x;
+    sumSquares += x * x;
+  }
+  double mean = sum / n;
+  double variance = n > 1 ? (sumSquares - n * mean * mean) / (n - 1) : 0;
+  halfWidth = 1.96 * _sets * sqrt(max(variance, 0.0) / n * (1 - n / _sets));
+  return _sets * mean;
+}
+
+/* ===================================================================== */
+
+// Ratio estimator of num / den over all the sets, with the delta method variance
+const double SetSampler::ratio(UINT64 Counters::*num, UINT64 Counters::*den, double &halfWidth) const
+{
+  double n = _samples.size(), sumNum = 0, sumDen = 0;
+  for (uint i = 0; i < _samples.size(); i++) {
+    sumNum += _samples[i].*num;
+    sumDen += _samples[i].*den;
+  }
+  halfWidth = 0;
+  if (sumDen == 0) return 0;
+  double r = sumNum / sumDen, sumSquares = 0;
+  for (uint i = 0; i < _samples.size(); i++) {
+    double d = _samples[i].*num - r * _samples[i].*den;
+    sumSquares += d * d;
+  }
+  double meanDen = sumDen / n;
+  if (n > 1) halfWidth = 1.96 * sqrt(sumSquares / (n - 1) / (n * meanDen * meanDen) * (1 - n / _sets));
+  return r;
+}
+
+/* ===================================================================== */
+
+// Print the estimates for the whole cache; MPKI needs the instruction count, which a replayed trace does not have
+void SetSampler::print(ostream &out, const UINT64 instructions) const
+{
+  double hw, missHW;
+  out << "Set sampling: " << _samples.size() << " of " << _sets << " sets (" << (_hashed ? "hash" : "stride") << "), "
+      << _filtered << " accesses filtered out" << endl;
+  double missRate = ratio(&Counters::misses, &Counters::accesses, hw);
+  out << "  Estimated hit rate: " << 1 - missRate << " +/- " << hw << " (95% confidence)" << endl;
+  double accesses = total(&Counters::accesses, hw);
+  out << "  Estimated accesses: " << accesses << " +/- " << hw << endl;
+  double misses = total(&Counters::misses, missHW);
+  out << "  Estimated misses: " << misses << " +/- " << missHW << endl;
+  if (instructions) {
+    out << "  Instructions: " << instructions << " Estimated MPKI: " << 1000 * misses / instructions
+        << " +/- " << 1000 * missHW / instructions << endl;
+  }
+  double prefetches = total(&Counters::prefetches, hw);
+  out << "  Estimated prefetches: " << prefetches << " +/- " << hw << endl;
+  double used = total(&Counters::usedPrefetches, hw);
+  out << "  Estimated used prefetches: " << used << " +/- " << hw << endl;
+  double accuracy = ratio(&Counters::usedPrefetches, &Counters::prefetches, hw);
+  out << "  Estimated prefetch accuracy: " << accuracy << " +/- " << hw << endl;
+}
+
+#endif
+
+/* ===================================================================== */
+/* eof */
+/* ===================================================================== */
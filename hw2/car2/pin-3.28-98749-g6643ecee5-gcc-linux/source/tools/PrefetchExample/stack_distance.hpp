@@ -0,0 +1,127 @@
+#ifndef STACK_DISTANCE_H
+#define STACK_DISTANCE_H
+
+#include <algorithm>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+/* Stack distance profiling (-stack_distance)
+    The LRU stack distance of an access is the number of distinct blocks accessed since the last
+    access to the same block. A fully associative LRU cache of C blocks hits exactly the accesses
+    with a distance below C (Mattson et al., 1970), so one histogram of the distances gives the miss
+    ratio of every cache size. The distances are counted as in Olken (1981): a Fenwick tree over
+    time holds a 1 at the time of the last access of every block, and the distance is the sum
+    between the previous access of the block and now, in O(log n) per access.
+    With S sets every set is an LRU stack of its own, and a distance below A is a hit in an
+    S-set, A-way cache.
+*/
+
+// The stack distances of the blocks of one LRU stack
+class OlkenStack {
+public:
+  OlkenStack(): _tree(1 << 8, 0), _now(0) {}
+  const INT64 access(const UINT64 block); // -1 on the first access to the block
+private:
+  void add(UINT64 time, const INT32 delta) {for (; time < _tree.size(); time += time & -time) _tree[time] += delta;}
+  const UINT64 prefix(UINT64 time) const {UINT64 sum = 0; for (; time > 0; time -= time & -time) sum += _tree[time]; return sum;}
+  void compact();
+  unordered_map<UINT64, UINT64> _last; // block -> time of its last access
+  vector<UINT32> _tree;                // Fenwick tree indexed by time, from 1
+  UINT64 _now;
+};
+
+/* ===================================================================== */
+
+const INT64 OlkenStack::access(const UINT64 block)
+{
+  if (_now + 1 >= _tree.size()) compact();
+  _now++;
+  INT64 distance = -1;
+  unordered_map<UINT64, UINT64>::iterator it = _last.find(block);
+  if (it != _last.end()) {
+    distance = prefix(_now - 1) - prefix(it->second);
+    add(it->second, -1);
+    it->second = _now;
+  } else {
+    _last[block] = _now;
+  }
+  add(_now, 1);
+  return distance;
+}
+
+/* ===================================================================== */
+
+// Time only advances, so once the tree is full the last accesses are renumbered 1..blocks in their
+// order and the tree is rebuilt, twice as large as the blocks it holds
+void OlkenStack::compact()
+{
+  vector<pair<UINT64, UINT64> > order; // time, block
+  order.reserve(_last.size());
+  for (unordered_map<UINT64, UINT64>::iterator it = _last.begin(); it != _last.end(); ++it) order.push_back(make_pair(it->second, it->first));
+  sort(order.begin(), order.end());
+  _tree.assign(max<UINT64>(2 * order.size() + 2, 1 << 8), 0);
+  for (UINT64 i = 0; i < order.size(); i++) {
+    _last[order[i].second] = i + 1;
+    add(i + 1, 1);
+  }
+  _now = order.size();
+}
+
+/* ===================================================================== */
+
+// The histogram of the stack distances of an LRU cache with a number of sets, 1 for fully associative.
+// Distances of maxDistance blocks per set or more are only counted together
+class StackDistanceProfiler {
+public:
+  StackDistanceProfiler(const UINT32 sets, const int blockSize, const UINT64 maxDistance): _stacks(sets), _histogram(maxDistance + 1, 0),
+                  _sets(sets), _blockSize(blockSize), _accesses(0), _cold(0) {}
+  void access(const UINT64 addr);
+  void print(ostream &out) const;
+private:
+  vector<OlkenStack> _stacks; // per set
+  vector<UINT64> _histogram;  // accesses per distance, the last entry for maxDistance or more
+  UINT64 _sets;
+  UINT64 _blockSize;
+  UINT64 _accesses;
+  UINT64 _cold; // first accesses to a block
+};
+
+/* ===================================================================== */
+
+void StackDistanceProfiler::access(const UINT64 addr)
+{
+  UINT64 block = addr / _blockSize;
+  INT64 distance = _stacks[block % _sets].access(block);
+  _accesses++;
+  if (distance < 0) _cold++;
+  else _histogram[min<UINT64>(distance, _histogram.size() - 1)]++;
+}
+
+/* ===================================================================== */
+
+// Print the LRU miss ratio of every power of two of blocks per set up to maxDistance
+void StackDistanceProfiler::print(ostream &out) const
+{
+  if (_sets == 1) out << "Stack distance profile (fully associative LRU, " << _blockSize << "B blocks)";
+  else out << "Stack distance profile (" << _sets << " sets, LRU, " << _blockSize << "B blocks)";
+  out << ": " << _accesses << " accesses, " << _cold << " cold misses" << endl;
+  out << (_sets == 1 ? "  Blocks" : "  Ways") << " Bytes Miss-ratio" << endl;
+  UINT64 hits = 0; // distances below the capacity
+  UINT64 capacity = 1;
+  for (UINT64 d = 0; d < _histogram.size() - 1; d++) {
+    hits += _histogram[d];
+    if (d + 1 == capacity) {
+      out << "  " << capacity << " " << capacity * _sets * _blockSize << " " << (_accesses ? double(_accesses - hits) / double(_accesses) : 0.0) << endl;
+      capacity *= 2;
+    }
+  }
+}
+
+#endif
+
+/* ===================================================================== */
+/* eof */
+/* ===================================================================== */
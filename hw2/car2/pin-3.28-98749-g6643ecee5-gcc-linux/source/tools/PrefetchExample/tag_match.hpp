@@ -0,0 +1,97 @@
+#ifndef TAG_MATCH_H
+#define TAG_MATCH_H
+
+#ifdef __SSE2__
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+// Compare the tags of all the ways of a set at once. The tag of an invalid way is INVALID_TAG, so
+// the valid bits need no separate check. A tag is the address divided by sets * block size, which
+// never reaches INVALID_TAG if that product is at least 2. With one set of one-byte blocks the tag
+// is the address itself: the TLB arrays and paging-structure caches of tlb.hpp are such caches, and
+// they look up page numbers and shifted addresses, which stay far below it. The result is a bitmask
+// with bit i set if way i matches; sets of up to 32 ways.
+
+const UINT64 INVALID_TAG = ~UINT64(0);
+
+/* ===================================================================== */
+
+inline const UINT32 matchWaysScalar(const UINT64 *tags, const int ways, const UINT64 tag)
+{
+  UINT32 mask = 0;
+  for (int i = 0; i < ways; i++) mask |= UINT32(tags[i] == tag) << i;
+  return mask;
+}
+
+#ifdef __SSE2__
+
+/* ===================================================================== */
+
+// Two ways per compare. SSE2 has no 64-bit compare, so both 32-bit halves must be equal
+inline const UINT32 matchWaysSSE2(const UINT64 *tags, const int ways, const UINT64 tag)
+{
+  __m128i probe = _mm_set1_epi64x(tag);
+  UINT32 mask = 0;
+  int i = 0;
+  for (; i + 2 <= ways; i += 2) {
+    __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(tags + i)), probe);
+    eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+    mask |= UINT32(_mm_movemask_pd(_mm_castsi128_pd(eq))) << i;
+  }
+  for (; i < ways; i++) mask |= UINT32(tags[i] == tag) << i;
+  return mask;
+}
+
+/* ===================================================================== */
+
+// Four ways per compare; only called if the CPU and the OS support AVX2
+__attribute__((target("avx2"))) inline const UINT32 matchWaysAVX2(const UINT64 *tags, const int ways, const UINT64 tag)
+{
+  __m256i probe = _mm256_set1_epi64x(tag);
+  UINT32 mask = 0;
+  int i = 0;
+  for (; i + 4 <= ways; i += 4) {
+    __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(tags + i)), probe);
+    mask |= UINT32(_mm256_movemask_pd(_mm256_castsi256_pd(eq))) << i;
+  }
+  for (; i < ways; i++) mask |= UINT32(tags[i] == tag) << i;
+  return mask;
+}
+
+/* ===================================================================== */
+
+// AVX2 needs the CPU feature (cpuid leaf 7) and the OS saving the YMM registers (XCR0)
+inline const bool cpuHasAVX2()
+{
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE) || !(ecx & bit_AVX)) return false;
+  unsigned int xcr0, xcr0High;
+  __asm__ volatile ("xgetbv" : "=a"(xcr0), "=d"(xcr0High) : "c"(0));
+  if ((xcr0 & 6) != 6) return false;
+  return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_AVX2);
+}
+
+static const bool tagMatchAVX2 = cpuHasAVX2();
+
+#endif
+
+/* ===================================================================== */
+
+// WAYS is the associativity if it is known at compile time, 0 otherwise. Sets of less than
+// four ways are compared one way at a time
+template <UINT32 WAYS>
+inline const UINT32 matchWays(const UINT64 *tags, const int ways, const UINT64 tag)
+{
+  const int n = WAYS ? WAYS : ways;
+#ifdef __SSE2__
+  if (n >= 4) return tagMatchAVX2 ? matchWaysAVX2(tags, n, tag) : matchWaysSSE2(tags, n, tag);
+#endif
+  return matchWaysScalar(tags, n, tag);
+}
+
+#endif
+
+/* ===================================================================== */
+/* eof */
+/* ===================================================================== */
@@ -0,0 +1,102 @@
+#ifndef TLB_H
+#define TLB_H
+
+#include <iostream>
+#include <vector>
+
+#include "dcache_for_prefetcher.hpp"
+
+using namespace std;
+
+/* TLB hierarchy (-tlb)
+    An L1 DTLB and an L2 STLB, set associative with LRU, are looked up with the virtual page number
+    of every demand access; they are Caches of one-byte blocks indexed by the page number. An STLB
+    miss walks the 4-level x86-64 page table (PML4, PDPT, PD, PT). The walk starts below the deepest
+    level found in the paging-structure caches, one small fully associative cache per non-leaf
+    level as the PML4E, PDPTE and PDE caches of x86 cores, and reads one entry per level from there
+    on, each read costing walkLatency cycles. A 2MB page ends the walk at the PD and a 1GB page at
+    the PDPT. The cost of an access is 0 on a DTLB hit, stlbLatency on an STLB hit and stlbLatency
+    plus the walk on an STLB miss.
+*/
+class TLBHierarchy {
+public:
+  TLBHierarchy(const int l1Entries, const int l1Ways, const int l2Entries, const int l2Ways, const UINT32 pageShift,
+               const int pscEntries, const UINT32 stlbLatency, const UINT32 walkLatency);
+  void access(const UINT64 vaddr);
+  void print(ostream &out, const string &name, const UINT64 instructions) const;
+private:
+  static const UINT32 levelShift(const UINT32 level) {return 39 - 9 * level;} // lowest address bit indexing a level, 0 for the PML4
+  const UINT32 walk(const UINT64 vaddr); // the page table entries read
+  Cache _l1;
+  Cache _l2;
+  vector<Cache> _psc; // paging-structure caches of the levels above the leaf, from the root
+  UINT32 _pageShift;
+  UINT32 _leaf;       // level of the page table entry that maps a page
+  UINT32 _stlbLatency;
+  UINT32 _walkLatency;
+  UINT64 _accesses;
+  UINT64 _l1Misses;
+  UINT64 _l2Misses;
+  UINT64 _walkReads;
+  UINT64 _cycles;
+};
+
+/* ===================================================================== */
+
+TLBHierarchy::TLBHierarchy(const int l1Entries, const int l1Ways, const int l2Entries, const int l2Ways, const UINT32 pageShift,
+                const int pscEntries, const UINT32 stlbLatency, const UINT32 walkLatency): _l1(l1Entries / l1Ways, l1Ways, 1),
+                _l2(l2Entries / l2Ways, l2Ways, 1), _pageShift(pageShift), _leaf((39 - pageShift) / 9), _stlbLatency(stlbLatency),
+                _walkLatency(walkLatency), _accesses(0), _l1Misses(0), _l2Misses(0), _walkReads(0), _cycles(0)
+{
+  for (UINT32 level = 0; level < _leaf; level++) _psc.push_back(Cache(1, pscEntries, 1));
+}
+
+/* ===================================================================== */
+
+// Probe the paging-structure caches from the level above the leaf up, and fill the levels the walk read
+const UINT32 TLBHierarchy::walk(const UINT64 vaddr)
+{
+  int found = _leaf; // the walk reads the levels from found to the leaf
+  while (found > 0 && !_psc[found - 1].probeTag(vaddr >> levelShift(found - 1))) found--;
+  for (UINT32 level = found; level < _leaf; level++) _psc[level].fillLine(vaddr >> levelShift(level));
+  return _leaf + 1 - found;
+}
+
+/* ===================================================================== */
+
+void TLBHierarchy::access(const UINT64 vaddr)
+{
+  UINT64 page = vaddr >> _pageShift;
+  _accesses++;
+  if (_l1.probeTag(page)) return;
+  _l1Misses++;
+  _l1.fillLine(page);
+  _cycles += _stlbLatency;
+  if (_l2.probeTag(page)) return;
+  _l2Misses++;
+  _l2.fillLine(page);
+  UINT32 reads = walk(vaddr);
+  _walkReads += reads;
+  _cycles += UINT64(reads) * _walkLatency;
+}
+
+/* ===================================================================== */
+
+// MPKI needs the instruction count, which a replayed trace does not have
+void TLBHierarchy::print(ostream &out, const string &name, const UINT64 instructions) const
+{
+  out << name << " (" << (UINT64(1) << _pageShift) << "B pages): Accesses: " << _accesses << " DTLB misses: " << _l1Misses
+      << " STLB misses: " << _l2Misses << endl;
+  out << "  DTLB miss rate: " << (_accesses ? double(_l1Misses) / double(_accesses) : 0.0)
+      << " STLB miss rate: " << (_l1Misses ? double(_l2Misses) / double(_l1Misses) : 0.0);
+  if (instructions) out << " STLB MPKI: " << 1000.0 * _l2Misses / instructions;
+  out << endl;
+  out << "  Page walk reads: " << _walkReads << " per walk: " << (_l2Misses ? double(_walkReads) / double(_l2Misses) : 0.0)
+      << " Translation cycles: " << _cycles << " per access: " << (_accesses ? double(_cycles) / double(_accesses) : 0.0) << endl;
+}
+
+#endif
+
+/* ===================================================================== */
+/* eof */
+/* ===================================================================== */